@@ -0,0 +1,487 @@
+/*
+ * Benchmarks the hash table and tree implementations on synthetic
+ * corpora.  Build with
+ *
+ *    gcc -O2 -W -Wall -ansi -pedantic bench-main.c htable.c tree.c \
+ *        mylib.c -o bench-main -pthread
+ *
+ * Results are written to stdout as CSV, one line per corpus, structure
+ * and phase.
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include "mylib.h"
+#include "htable.h"
+#include "tree.h"
+
+/* Longest word generated, plus room for a miss suffix and '\0'. */
+#define WORD_LEN 64
+
+typedef enum corpus_e {UNIFORM, ZIPF, SORTED, ADVERSARIAL} corpus_t;
+
+static const char *corpus_names[] = {
+    "uniform", "zipf", "sorted", "adversarial"
+};
+
+/* The structures benchmarked, hash tables first and then trees. */
+static const char *structure_names[] = {
+    "linear", "double", "robinhood", "group", "bst", "rbt"
+};
+static const hashing_t hashings[] = {LINEAR_P, DOUBLE_H, ROBIN_HOOD, GROUP_P};
+
+#define NUM_STRUCTURES 6
+#define NUM_HTABLES 4
+
+/* One thread's share of a phase run on a shared hash table. */
+struct shared_job {
+    htable h;
+    int thread;
+    int search;
+    char **words;
+    int n;
+    double *lat;
+};
+
+/* State of the xorshift generator, so runs repeat on every platform. */
+static unsigned int rng_state;
+
+/**
+ * Returns the next number from the xorshift generator.
+ * @return a pseudo-random 32-bit number.
+ */
+static unsigned int rng_next(void){
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state & 0xffffffffu;
+}
+
+/**
+ * Returns a pseudo-random number in [0, 1).
+ * @return the number.
+ */
+static double rng_double(void){
+    return rng_next() / 4294967296.0;
+}
+
+/**
+ * Fills in a random word of 3 to 10 lower case letters.
+ * @param word the buffer to fill, at least WORD_LEN long.
+ */
+static void random_word(char *word){
+    int len = 3 + rng_next() % 8;
+    int i;
+
+    for(i = 0; i < len; i++){
+        word[i] = 'a' + rng_next() % 26;
+    }
+    word[len] = '\0';
+}
+
+/**
+ * Fills in the i'th word made of "Aa" and "BB" blocks.  Both blocks
+ * have the same 31 * h hash, so every such word of the same length
+ * has the same hash and lands in the same probe sequence.
+ * @param word the buffer to fill, at least 2 * bits + 1 long.
+ * @param i the position of the word in the sequence.
+ * @param bits the number of blocks in the word.
+ */
+static void adversarial_word(char *word, int i, int bits){
+    int j;
+
+    for(j = 0; j < bits; j++){
+        strcpy(word + 2 * j, (i >> j) & 1 ? "BB" : "Aa");
+    }
+    word[2 * bits] = '\0';
+}
+
+/**
+ * Compares two strings for qsort.
+ * @param a pointer to the first string.
+ * @param b pointer to the second string.
+ * @return the result of strcmp.
+ */
+static int compare_words(const void *a, const void *b){
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ * Compares two latencies for qsort.
+ * @param a pointer to the first latency.
+ * @param b pointer to the second latency.
+ * @return negative, zero or positive as a is less, equal or greater.
+ */
+static int compare_doubles(const void *a, const void *b){
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Draws words again until no two are the same.  Random words of three
+ * letters repeat often, so without this there would be fewer distinct
+ * words than asked for.
+ * @param words the words, which keep their places.
+ * @param n the number of words.
+ */
+static void redraw_repeats(char **words, int n){
+    char **sorted = emalloc(n * sizeof sorted[0]);
+    int repeats = 1;
+    int i;
+
+    while(repeats > 0){
+        memcpy(sorted, words, n * sizeof sorted[0]);
+        qsort(sorted, n, sizeof sorted[0], compare_words);
+        repeats = 0;
+        for(i = 1; i < n; i++){
+            if(strcmp(sorted[i - 1], sorted[i]) == 0){
+                /* the word is shared with words, so it changes there too */
+                random_word(sorted[i]);
+                repeats++;
+            }
+        }
+    }
+    free(sorted);
+}
+
+/**
+ * Creates the distinct words of a corpus along with the same number of
+ * words that are guaranteed not to be among them.
+ * @param type the kind of corpus.
+ * @param vocab the number of distinct words.
+ * @param misses set to the words that are not in the corpus.
+ * @return the distinct words, sorted for a SORTED corpus.
+ */
+static char **make_vocab(corpus_t type, int vocab, char ***misses){
+    char **words = emalloc(vocab * sizeof words[0]);
+    char **absent = emalloc(vocab * sizeof absent[0]);
+    int bits = 1;
+    int i;
+
+    while((1L << bits) < 2L * vocab) bits++;
+    for(i = 0; i < vocab; i++){
+        words[i] = emalloc(WORD_LEN);
+        absent[i] = emalloc(WORD_LEN);
+        if(type == ADVERSARIAL){
+            /* the misses collide with the words too */
+            adversarial_word(words[i], i, bits);
+            adversarial_word(absent[i], vocab + i, bits);
+        } else {
+            random_word(words[i]);
+            random_word(absent[i]);
+            /* words never contain digits, so this cannot be present */
+            strcat(absent[i], "0");
+        }
+    }
+    if(type != ADVERSARIAL) redraw_repeats(words, vocab);
+    if(type == SORTED) qsort(words, vocab, sizeof words[0], compare_words);
+    *misses = absent;
+    return words;
+}
+
+/**
+ * Creates the stream of words to insert, drawn from the vocabulary.
+ * @param type the kind of corpus.
+ * @param words the distinct words.
+ * @param vocab the number of distinct words.
+ * @param n the number of words to draw.
+ * @return the stream of words, pointing into words.
+ */
+static char **make_stream(corpus_t type, char **words, int vocab, int n){
+    char **stream = emalloc(n * sizeof stream[0]);
+    double *cumulative = NULL;
+    double u;
+    int lo, hi, mid;
+    int i;
+
+    if(type == ZIPF){
+        cumulative = emalloc(vocab * sizeof cumulative[0]);
+        for(i = 0; i < vocab; i++){
+            cumulative[i] = 1.0 / (i + 1) + (i > 0 ? cumulative[i - 1] : 0.0);
+        }
+    }
+    for(i = 0; i < n; i++){
+        if(type == ZIPF){
+            u = rng_double() * cumulative[vocab - 1];
+            for(lo = 0, hi = vocab - 1; lo < hi; ){
+                mid = (lo + hi) / 2;
+                if(cumulative[mid] < u) lo = mid + 1; else hi = mid;
+            }
+            stream[i] = words[lo];
+        } else if(type == SORTED){
+            /* each word repeated in turn, so the stream stays sorted */
+            stream[i] = words[(long) i * vocab / n];
+        } else {
+            stream[i] = words[rng_next() % vocab];
+        }
+    }
+    free(cumulative);
+    return stream;
+}
+
+/**
+ * Returns a monotonic time in nanoseconds.
+ * @return the time.
+ */
+static double now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Prints one CSV line of results, sorting the latencies in the process.
+ * @param corpus the name of the corpus.
+ * @param structure the name of the structure.
+ * @param phase the name of the phase.
+ * @param wall_ns the total time taken, in nanoseconds.
+ * @param lat the time taken by each operation, in nanoseconds.
+ * @param n the number of operations.
+ */
+static void report(const char *corpus, const char *structure,
+                   const char *phase, double wall_ns, double *lat, int n){
+    qsort(lat, n, sizeof lat[0], compare_doubles);
+    printf("%s,%s,%s,%d,%.6f,%.1f,%.0f,%.0f,%.0f,%.0f,%.0f\n",
+           corpus, structure, phase, n, wall_ns / 1e9, wall_ns / n,
+           lat[n / 2], lat[(int) (n * 0.9)], lat[(int) (n * 0.99)],
+           lat[(int) (n * 0.999)], lat[n - 1]);
+    fflush(stdout);
+}
+
+/**
+ * Runs the fill, hit-search and miss-search phases on one structure.
+ * Each operation is timed on its own for the percentiles, so the times
+ * include the cost of reading the clock.
+ * @param corpus the name of the corpus.
+ * @param s the index of the structure in structure_names.
+ * @param stream the words to insert.
+ * @param n the number of words in stream.
+ * @param misses words that are not in stream.
+ * @param m the number of words in misses.
+ * @param lat scratch space for at least n latencies.
+ */
+static void run(const char *corpus, int s, char **stream, int n,
+                char **misses, int m, double *lat){
+    htable h = NULL;
+    tree t = NULL;
+    double start, op;
+    int phase;
+    int i;
+    int k;
+    char **words;
+
+    if(s < NUM_HTABLES){
+        h = htable_new(113, hashings[s], PRIME_SIZE, WORD_31);
+    } else {
+        t = tree_new(s == NUM_HTABLES ? BST : RBT);
+    }
+
+    for(phase = 0; phase < 3; phase++){
+        words = phase == 2 ? misses : stream;
+        k = phase == 2 ? m : n;
+        start = now_ns();
+        for(i = 0; i < k; i++){
+            op = now_ns();
+            if(phase == 0){
+                if(h != NULL) htable_insert(h, words[i]);
+                else t = tree_insert(t, words[i]);
+            } else {
+                if(h != NULL) htable_search(h, words[i]);
+                else tree_search(t, words[i]);
+            }
+            lat[i] = now_ns() - op;
+        }
+        report(corpus, structure_names[s],
+               phase == 0 ? "fill" : phase == 1 ? "hit" : "miss",
+               now_ns() - start, lat, k);
+    }
+
+    if(h != NULL) htable_free(h);
+    else tree_free(t);
+}
+
+/**
+ * Inserts or searches for a job's words in a shared hash table, timing
+ * each operation.
+ * @param arg the shared_job to run.
+ * @return NULL.
+ */
+static void *run_shared_job(void *arg){
+    struct shared_job *job = arg;
+    double op;
+    int i;
+
+    for(i = 0; i < job->n; i++){
+        op = now_ns();
+        if(job->search) htable_search_shared(job->h, job->words[i]);
+        else htable_insert_shared(job->h, job->thread, job->words[i]);
+        job->lat[i] = now_ns() - op;
+    }
+    return NULL;
+}
+
+/**
+ * Runs the fill and hit-search phases on one hash table shared by a
+ * number of threads, each taking an equal slice of the stream.  The
+ * table is made large enough for the whole vocabulary first, since a
+ * shared table cannot grow.
+ * @param corpus the name of the corpus.
+ * @param s the index of the hash table in structure_names.
+ * @param threads the number of threads.
+ * @param stream the words to insert.
+ * @param n the number of words in stream.
+ * @param vocab the number of distinct words in stream.
+ * @param lat scratch space for at least n latencies.
+ */
+static void run_shared(const char *corpus, int s, int threads,
+                       char **stream, int n, int vocab, double *lat){
+    struct shared_job *job = emalloc(threads * sizeof job[0]);
+    pthread_t *thread = emalloc(threads * sizeof thread[0]);
+    /* htable_insert_shared keeps a slot free for each thread */
+    htable h = htable_new((vocab + threads) * 4 / 3 + 2, hashings[s],
+                          PRIME_SIZE, WORD_31);
+    char phase[32];
+    double start;
+    int search;
+    int i;
+
+    htable_share(h, threads);
+    for(search = 0; search < 2; search++){
+        for(i = 0; i < threads; i++){
+            job[i].h = h;
+            job[i].thread = i;
+            job[i].search = search;
+            job[i].words = stream + (long) n * i / threads;
+            job[i].n = (long) n * (i + 1) / threads - (long) n * i / threads;
+            job[i].lat = lat + (long) n * i / threads;
+        }
+        start = now_ns();
+        for(i = 0; i < threads; i++){
+            if(pthread_create(&thread[i], NULL, run_shared_job, &job[i])
+               != 0){
+                fprintf(stderr, "Can't create thread!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for(i = 0; i < threads; i++) pthread_join(thread[i], NULL);
+        sprintf(phase, "%s_shared_%d", search ? "hit" : "fill", threads);
+        report(corpus, structure_names[s], phase, now_ns() - start, lat, n);
+    }
+
+    htable_free(h);
+    free(thread);
+    free(job);
+}
+
+/**
+ * Prints the help message.
+ */
+static void print_help(){
+    fprintf(stderr, "Usage: ./bench-main [OPTION]...\n");
+    fprintf(stderr, "\nBenchmark each hash table mode and tree type on ");
+    fprintf(stderr, "synthetic corpora,\nprinting CSV results to stdout.\n\n");
+    fprintf(stderr, " -c CORPUS    Only use CORPUS: uniform, zipf, sorted or "
+"adversarial\n");
+    fprintf(stderr, " -j JOBS      Also time 1, 2, 4... up to JOBS threads "
+"sharing one\n              hash table, for each mode but Robin Hood\n");
+    fprintf(stderr, " -n WORDS     Insert WORDS words per run (default "
+"100000)\n");
+    fprintf(stderr, " -r SEED      Seed the word generator with SEED "
+"(default 1)\n");
+    fprintf(stderr, " -v VOCAB     Draw words from VOCAB distinct words "
+"(default 10000)\n");
+    fprintf(stderr, "\n -h           Print this message\n");
+}
+
+/**
+ * Generates each corpus and benchmarks every structure on it.
+ * @param argc number of command line arguments.
+ * @param argv array of the command line arguments.
+ * @return EXIT_SUCCESS on execution without errors.
+ */
+int main(int argc, char **argv){
+    const char *optstring = "c:j:n:r:v:h";
+    int option;
+    int only = -1;
+    int jobs = 0;
+    int threads;
+    int n = 100000;
+    int vocab = 10000;
+    unsigned int seed = 1;
+    char **words, **misses, **stream;
+    double *lat;
+    int c, s, i;
+
+    while((option = getopt(argc, argv, optstring)) != EOF){
+        switch(option){
+            case 'c':
+                for(only = 0; only < 4; only++){
+                    if(strcmp(optarg, corpus_names[only]) == 0) break;
+                }
+                if(only == 4){
+                    print_help();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'j':
+                jobs = atoi(optarg);
+                break;
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'r':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'v':
+                vocab = atoi(optarg);
+                break;
+            default:
+                print_help();
+                exit(EXIT_FAILURE);
+        }
+    }
+    if(n <= 0 || vocab <= 0){
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+
+    lat = emalloc((n > vocab ? n : vocab) * sizeof lat[0]);
+    printf("corpus,structure,phase,ops,wall_s,ns_per_op,"
+           "p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+    for(c = 0; c < 4; c++){
+        if(only >= 0 && c != only) continue;
+        rng_state = seed != 0 ? seed : 1;
+        words = make_vocab(c, vocab, &misses);
+        stream = make_stream(c, words, vocab, n);
+        for(s = 0; s < NUM_STRUCTURES; s++){
+            run(corpus_names[c], s, stream, n, misses, vocab, lat);
+        }
+        /* threads sharing a table cannot move keys as Robin Hood does */
+        for(s = 0; jobs > 0 && s < NUM_HTABLES; s++){
+            if(hashings[s] == ROBIN_HOOD) continue;
+            for(threads = 1; ; threads = threads * 2 < jobs ? threads * 2
+                                                            : jobs){
+                run_shared(corpus_names[c], s, threads, stream, n, vocab,
+                           lat);
+                if(threads == jobs) break;
+            }
+        }
+        for(i = 0; i < vocab; i++){
+            free(words[i]);
+            free(misses[i]);
+        }
+        free(stream);
+        free(misses);
+        free(words);
+    }
+    free(lat);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "mylib.h"
+#include "bloom.h"
+
+/* Bytes in a block, one cache line, which holds every bit of a key. */
+#define BLOOM_BLOCK 64
+
+/* Bits in a block. */
+#define BLOOM_BLOCK_BITS (8 * BLOOM_BLOCK)
+
+/* Number of bits set for each key. */
+#define BLOOM_K 7
+
+struct bloomrec {
+    /* blocks, aligned to a cache line within memory */
+    unsigned char *bits;
+    unsigned char *memory;
+    unsigned int num_blocks;
+    int num_keys;
+    /* lookups made, and how many of them the filter ruled out */
+    long queries;
+    long negatives;
+};
+
+/**
+ * Mixes the bits of a hash with the MurmurHash3 finaliser, so every
+ * bit of the result depends on every bit of h.
+ * @param h the hash.
+ * @return the mixed hash.
+ */
+static unsigned int bloom_mix(unsigned int h){
+    h ^= h >> 16;
+    h = (h * 0x85ebca6bu) & 0xffffffffu;
+    h ^= h >> 13;
+    h = (h * 0xc2b2ae35u) & 0xffffffffu;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ * Hashes a string with 32-bit FNV-1a and then mixes the result.
+ * @param s the string.
+ * @return the hash.
+ */
+static unsigned int bloom_hash(char *s){
+    unsigned int h = 2166136261u;
+
+    while(*s != '\0'){
+        h = ((h ^ (unsigned char) *s++) * 16777619u) & 0xffffffffu;
+    }
+    return bloom_mix(h);
+}
+
+/**
+ * Finds the block of a key and where its bits start within the block.
+ * The bits are picked by a second hash so they do not depend on which
+ * block was picked.
+ * @param b the filter.
+ * @param s the key.
+ * @param bits set to the second hash, the low bits giving the first bit
+ *        and the high bits the step between bits.
+ * @return the first byte of the block.
+ */
+static unsigned char *bloom_block(bloom b, char *s, unsigned int *bits){
+    unsigned int h = bloom_hash(s);
+
+    *bits = bloom_mix(h ^ 0x5bd1e995u);
+    return b->bits + BLOOM_BLOCK * (h & (b->num_blocks - 1));
+}
+
+/**
+ * Creates an empty filter sized for a number of keys.  Every key sets
+ * BLOOM_K bits in a single cache line sized block, so a lookup reads
+ * one line however many bits it tests.  At 10 bits per key about 1% of
+ * absent keys get through.
+ * @param num_keys the number of keys that will be added.
+ * @param bits_per_key bits of filter to allow for each key.
+ * @return the new filter.
+ */
+bloom bloom_new(int num_keys, int bits_per_key){
+    bloom b = emalloc(sizeof *b);
+    unsigned long want = (unsigned long) num_keys * bits_per_key
+                         / BLOOM_BLOCK_BITS;
+    unsigned long i;
+
+    /* a power of two number of blocks, so one is picked with a mask */
+    b->num_blocks = 1;
+    while(b->num_blocks < want) b->num_blocks *= 2;
+    b->memory = emalloc(b->num_blocks * BLOOM_BLOCK + BLOOM_BLOCK - 1);
+    b->bits = b->memory + (BLOOM_BLOCK - (unsigned long) b->memory
+                           % BLOOM_BLOCK) % BLOOM_BLOCK;
+    for(i = 0; i < (unsigned long) b->num_blocks * BLOOM_BLOCK; i++){
+        b->bits[i] = 0;
+    }
+    b->num_keys = 0;
+    b->queries = 0;
+    b->negatives = 0;
+    return b;
+}
+
+/**
+ * Adds a key to the filter.
+ * @param b the filter.
+ * @param s the key.
+ */
+void bloom_add(bloom b, char *s){
+    unsigned int bit;
+    unsigned char *block = bloom_block(b, s, &bit);
+    unsigned int step = (bit >> 16) | 1;
+    int i;
+
+    for(i = 0; i < BLOOM_K; i++, bit += step){
+        bit %= BLOOM_BLOCK_BITS;
+        block[bit / 8] |= 1 << (bit % 8);
+    }
+    b->num_keys++;
+}
+
+/**
+ * Checks whether a key might have been added to the filter.
+ * @param b the filter.
+ * @param s the key.
+ * @return 0 if the key was certainly never added, 1 if it may have been.
+ */
+int bloom_check(bloom b, char *s){
+    unsigned int bit;
+    unsigned char *block = bloom_block(b, s, &bit);
+    unsigned int step = (bit >> 16) | 1;
+    int i;
+
+    b->queries++;
+    for(i = 0; i < BLOOM_K; i++, bit += step){
+        bit %= BLOOM_BLOCK_BITS;
+        if(!(block[bit / 8] & (1 << (bit % 8)))){
+            b->negatives++;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Prints the size of the filter, its false positive rate as expected
+ * from the bits set in each block, and the rate it actually had over
+ * the lookups made so far.
+ * @param b the filter.
+ * @param stream the stream to print to.
+ * @param absent how many of the lookups were for keys not in the filter.
+ */
+void bloom_print_stats(bloom b, FILE *stream, int absent){
+    double expected = 0.0;
+    double fill;
+    double pass;
+    long set = 0;
+    int count;
+    unsigned int i;
+    int j;
+
+    for(i = 0; i < b->num_blocks; i++){
+        count = 0;
+        for(j = 0; j < BLOOM_BLOCK_BITS; j++){
+            count += (b->bits[i * BLOOM_BLOCK + j / 8] >> (j % 8)) & 1;
+        }
+        set += count;
+        /* an absent key gets through if all of its bits are set */
+        fill = count / (double) BLOOM_BLOCK_BITS;
+        for(pass = 1.0, j = 0; j < BLOOM_K; j++) pass *= fill;
+        expected += pass;
+    }
+    expected /= b->num_blocks;
+
+    fprintf(stream, "Bloom filter  : %u bytes, %.1f bits per key, %d "
+            "keys\n", b->num_blocks * BLOOM_BLOCK,
+            b->num_keys ? 8.0 * b->num_blocks * BLOOM_BLOCK / b->num_keys
+            : 0.0, b->num_keys);
+    fprintf(stream, "Bits set      : %.1f%%\n",
+            100.0 * set / ((double) b->num_blocks * BLOOM_BLOCK_BITS));
+    fprintf(stream, "Expected FPR  : %.3f%%\n", 100.0 * expected);
+    if(absent > 0){
+        fprintf(stream, "Measured FPR  : %.3f%% (%ld of %d absent words "
+                "passed)\n", 100.0 * (absent - b->negatives) / absent,
+                absent - b->negatives, absent);
+    }
+    fprintf(stream, "Ruled out     : %ld of %ld lookups\n", b->negatives,
+            b->queries);
+}
+
+/**
+ * Frees a filter.
+ * @param b the filter.
+ */
+void bloom_free(bloom b){
+    free(b->memory);
+    free(b);
+}
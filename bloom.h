@@ -0,0 +1,15 @@
+#ifndef BLOOM_H_
+#define BLOOM_H_
+
+#include <stdio.h>
+
+typedef struct bloomrec *bloom;
+
+extern bloom bloom_new(int num_keys, int bits_per_key);
+extern void bloom_add(bloom b, char *s);
+extern int bloom_check(bloom b, char *s);
+extern void bloom_print_stats(bloom b, FILE *stream, int absent);
+extern void bloom_free(bloom b);
+
+
+#endif
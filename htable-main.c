@@ -1,11 +1,72 @@
+/* clock_gettime is POSIX rather than ANSI C */
+#define _POSIX_C_SOURCE 199309L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <time.h>
 #include <string.h>
 #include "mylib.h"
 #include "htable.h"
+#include "bloom.h"
+#include "suggest.h"
+
+/* Number of words looked up at once when spell checking. */
+#define CHECK_BATCH 64
+
+/* Bits of Bloom filter for each word in the dictionary. */
+#define BLOOM_BITS 10
+
+/* Most spelling suggestions printed for an unknown word. */
+#define MAX_SUGGESTIONS 32
+
+/* Words printed in each snapshot of a window if -n is not given. */
+#define WINDOW_TOP 10
+
+/* Load factor a shared table is sized for without -l, as tables grow. */
+#define SHARED_LOAD 0.75
+
+/* Bytes at the start of the input whose words estimate the vocabulary. */
+#define SHARED_SAMPLE (1 << 20)
+
+/* Room for each word in a window, which is the longest word read. */
+#define WINDOW_WORD 256
+
+/* A slice of the input counted into a hash table by one thread. */
+struct fill_job {
+    char *text;
+    size_t len;
+    htable h;
+    /* the thread's number within a shared table, and words it read */
+    int thread;
+    long words;
+    /* the thread's own table for new words once the shared one is full */
+    htable spill;
+};
+
+/*
+ * The words read in the last stretch of a stream, oldest first, in a
+ * circular buffer of fixed size slots along with the time each was
+ * read, so words are copied in and out without allocating.
+ */
+struct window {
+    char (*words)[WINDOW_WORD];
+    time_t *times;
+    int size;
+    int start;
+    int count;
+};
 
+/* Where print_info writes, in large blocks. */
+static writer out;
+
+/* Words and frequencies collected by add_entry for sorting. */
+static char **entry_words;
+static int *entry_freqs;
+static int num_entries;
 
 /**
  * Prints words and their corresponding frequency of occurance
@@ -14,9 +75,519 @@
  * @param word the word to print.
  */
 static void print_info(int freq, char *word){
-    printf("%-4d %s\n", freq, word);
+    writer_int(out, freq, -4);
+    writer_char(out, ' ');
+    writer_str(out, word);
+    writer_char(out, '\n');
+}
+
+/**
+ * Adds a word and its frequency to the entries to be sorted.
+ * @param freq the frequency of the word.
+ * @param word the word.
+ */
+static void add_entry(int freq, char *word){
+    entry_words[num_entries] = word;
+    entry_freqs[num_entries++] = freq;
+}
+
+/* The Bloom filter being built by add_to_filter. */
+static bloom filter;
+
+/**
+ * Adds a word from the hash table to the Bloom filter.
+ * @param freq the frequency of the word.
+ * @param word the word to add.
+ */
+static void add_to_filter(int freq, char *word){
+    (void) freq;
+    bloom_add(filter, word);
 }
 
+/* The spelling suggester being built by add_to_speller. */
+static suggest speller;
+
+/* Number of suggestions to print for each unknown word. */
+static int num_suggestions;
+
+/**
+ * Adds a word from the hash table to the spelling suggester.
+ * @param freq the frequency of the word.
+ * @param word the word to add.
+ */
+static void add_to_speller(int freq, char *word){
+    suggest_add(speller, word, freq);
+}
+
+/**
+ * Prints an unknown word, followed on the same line by the closest
+ * words in the hash table if suggestions were asked for.
+ * @param word the unknown word.
+ */
+static void print_unknown(char *word){
+    char *sugg[MAX_SUGGESTIONS];
+    int n = 0;
+    int i;
+
+    if(speller != NULL){
+        n = suggest_lookup(speller, word, num_suggestions, sugg);
+    }
+    printf("%s", word);
+    for(i = 0; i < n; i++) printf(" %s", sugg[i]);
+    printf("\n");
+}
+
+
+/**
+ * Returns a monotonic wall-clock time.  Unlike clock, which adds up the
+ * processor time of every thread, it shows what threads save.
+ * @return the time in seconds.
+ */
+static double now_seconds(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Reports that a word could not be added because the hash table is as
+ * large as it can get, and exits.
+ */
+static void table_full(void){
+    fprintf(stderr, "Hash table is full!\n");
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Reads the whole of a stream into memory.
+ * @param stream the stream to read.
+ * @param len set to the number of characters read.
+ * @return the characters read, with one spare byte at the end.
+ */
+static char *read_all(FILE *stream, size_t *len){
+    size_t size = 65536;
+    char *text = emalloc(size + 1);
+    size_t n;
+
+    *len = 0;
+    while((n = fread(text + *len, 1, size - *len, stream)) > 0){
+        *len += n;
+        if(*len == size){
+            size *= 2;
+            text = erealloc(text, size + 1);
+        }
+    }
+    return text;
+}
+
+/**
+ * Fills a job's hash table with the words in its slice of the input.
+ * @param arg the fill_job to run.
+ * @return NULL.
+ */
+static void *fill_shard(void *arg){
+    struct fill_job *job = arg;
+    tokenizer tok = tokenizer_new_buffer(job->text, job->len, 256);
+    char *word;
+
+    while(tokenizer_next(tok, &word) != EOF){
+        if(htable_insert(job->h, word) == 0) table_full();
+    }
+    tokenizer_free(tok);
+    return NULL;
+}
+
+/**
+ * Counts a job's slice of the input into a hash table that the other
+ * jobs are counting into at the same time.  Once the shared table has
+ * reached its maximum load, new words go into the job's spill table,
+ * while words already in the shared table are still counted there.
+ * @param arg the fill_job to run.
+ * @return NULL.
+ */
+static void *fill_shared(void *arg){
+    struct fill_job *job = arg;
+    tokenizer tok = tokenizer_new_buffer(job->text, job->len, 256);
+    char *word;
+
+    job->words = 0;
+    while(tokenizer_next(tok, &word) != EOF){
+        if(htable_insert_shared(job->h, job->thread, word) == 0
+           && htable_insert(job->spill, word) == 0){
+            table_full();
+        }
+        job->words++;
+    }
+    tokenizer_free(tok);
+    return NULL;
+}
+
+/**
+ * Splits text into a slice for each job, each ending just after a
+ * non-word character, so no word is split between slices.
+ * @param text the text to split.
+ * @param len the number of characters in text.
+ * @param jobs the number of jobs.
+ * @param job set to the slices.
+ */
+static void split_input(char *text, size_t len, int jobs,
+                        struct fill_job *job){
+    size_t start = 0;
+    size_t end;
+    int i;
+
+    for(i = 0; i < jobs; i++){
+        end = i == jobs - 1 ? len : len / jobs * (i + 1);
+        if(end < start) end = start;
+        while(end < len && end > 0
+              && (isalnum((unsigned char) text[end - 1])
+                  || text[end - 1] == '\'')){
+            end++;
+        }
+        job[i].text = text + start;
+        job[i].len = end - start;
+        job[i].thread = i;
+        start = end;
+    }
+}
+
+/**
+ * Counts the words in some text, which is as many different words as
+ * it can hold.
+ * @param text the text.
+ * @param len the number of characters in text.
+ * @return the number of words.
+ */
+static long count_words(char *text, size_t len){
+    long words = 0;
+    int in_word = 0;
+    size_t i;
+
+    for(i = 0; i < len; i++){
+        if(isalnum((unsigned char) text[i])){
+            words += !in_word;
+            in_word = 1;
+        } else if(text[i] != '\''){
+            in_word = 0;
+        }
+    }
+    return words;
+}
+
+/**
+ * Estimates the number of different words in some text from a sample
+ * at its start.  The words seen in the first half of the sample and in
+ * all of it give the rate at which new words turn up as the text
+ * doubles, which is carried on to the length of the whole text.
+ * @param text the text, which is left unchanged.
+ * @param len the number of characters in text.
+ * @param words the number of words in text.
+ * @return the estimated number of different words, at most words.
+ */
+static long estimate_distinct(char *text, size_t len, long words){
+    size_t n = len < SHARED_SAMPLE ? len : SHARED_SAMPLE;
+    /* the tokenizer rewrites the words it splits, so use a copy */
+    char *sample = emalloc(n + 1);
+    htable seen = htable_new(1024, LINEAR_P, POW2_SIZE, FNV_1A);
+    tokenizer tok;
+    char *word;
+    long half;
+    long count = 0;
+    long seen_half = 0;
+    double estimate;
+    double growth;
+
+    memcpy(sample, text, n);
+    half = count_words(sample, n) / 2;
+    tok = tokenizer_new_buffer(sample, n, 256);
+    while(tokenizer_next(tok, &word) != EOF){
+        if(htable_insert(seen, word) == 0) table_full();
+        if(++count == half) seen_half = htable_size(seen);
+    }
+    estimate = htable_size(seen);
+    if(n < len && seen_half > 0){
+        /* doubling the text can at most double its words */
+        growth = estimate / seen_half;
+        if(growth > 2.0) growth = 2.0;
+        for(; count < words; count *= 2) estimate *= growth;
+    }
+    tokenizer_free(tok);
+    htable_free(seen);
+    free(sample);
+    return estimate < words ? (long) estimate : words;
+}
+
+/**
+ * Runs a fill function over each job in its own thread and waits for
+ * them all to finish.
+ * @param fill the function to run.
+ * @param job the jobs.
+ * @param jobs the number of jobs.
+ */
+static void run_jobs(void *fill(void *), struct fill_job *job, int jobs){
+    pthread_t *thread = emalloc(jobs * sizeof thread[0]);
+    int i;
+
+    for(i = 0; i < jobs; i++){
+        if(pthread_create(&thread[i], NULL, fill, &job[i]) != 0){
+            fprintf(stderr, "Can't create thread!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for(i = 0; i < jobs; i++) pthread_join(thread[i], NULL);
+    free(thread);
+}
+
+/**
+ * Fills a hash table from a stream using several threads that all count
+ * into it at once.  The table cannot grow while it is shared, so it is
+ * sized up front for an estimate of the number of different words, see
+ * estimate_distinct, at the load factor.  If the estimate falls short,
+ * the words that do not fit are counted into a table for each thread,
+ * as parallel_fill does, and merged in at the end.
+ * @param stream the stream to read words from.
+ * @param jobs the number of threads to use.
+ * @param cap the smallest capacity of the table, and the starting
+ *        capacity of each thread's table.
+ * @param load the maximum load of the tables, or less than 0 for
+ *        SHARED_LOAD.
+ * @param type the hashing method of the table.
+ * @param sizing the sizing policy of the table.
+ * @param hash_fn the hash function of the table.
+ * @return the filled hash table.
+ */
+static htable shared_fill(FILE *stream, int jobs, int cap, double load,
+                          hashing_t type, sizing_t sizing, hashfn_t hash_fn){
+    struct fill_job *job = emalloc(jobs * sizeof job[0]);
+    size_t len;
+    char *text = read_all(stream, &len);
+    long distinct = estimate_distinct(text, len, count_words(text, len));
+    double need;
+    htable h;
+    int i;
+
+    /* room for a slot per thread too, see htable_insert_shared */
+    need = (distinct + jobs) / (load > 0.0 ? load : SHARED_LOAD) + 1;
+    /* the table caps its own capacity, so only an int must be passed */
+    if(need > INT_MAX) need = INT_MAX;
+    h = htable_new(cap < need ? (int) need : cap, type, sizing, hash_fn);
+    if(load >= 0.0) htable_set_max_load(h, load);
+    htable_share(h, jobs);
+    split_input(text, len, jobs, job);
+    for(i = 0; i < jobs; i++){
+        job[i].h = h;
+        job[i].spill = htable_new(cap, type, sizing, hash_fn);
+        if(load >= 0.0) htable_set_max_load(job[i].spill, load);
+    }
+    run_jobs(fill_shared, job, jobs);
+    for(i = 0; i < jobs; i++){
+        htable_merge(h, job[i].spill);
+        htable_free(job[i].spill);
+    }
+    free(text);
+    free(job);
+    return h;
+}
+
+/**
+ * Fills a hash table from a stream using several threads.  The input is
+ * split into slices, see split_input, and each thread counts its slice
+ * into its own table before they are merged.
+ * @param h the hash table to fill.
+ * @param stream the stream to read words from.
+ * @param jobs the number of threads to use.
+ * @param cap the starting capacity of each thread's table.
+ * @param type the hashing method of each thread's table.
+ * @param sizing the sizing policy of each thread's table.
+ * @param hash_fn the hash function of each thread's table.
+ * @param load the maximum load of each thread's table, if not negative.
+ */
+static void parallel_fill(htable h, FILE *stream, int jobs, int cap,
+                          hashing_t type, sizing_t sizing, hashfn_t hash_fn,
+                          double load){
+    struct fill_job *job = emalloc(jobs * sizeof job[0]);
+    size_t len;
+    char *text = read_all(stream, &len);
+    int i;
+
+    split_input(text, len, jobs, job);
+    for(i = 0; i < jobs; i++){
+        job[i].h = htable_new(cap, type, sizing, hash_fn);
+        if(load >= 0.0) htable_set_max_load(job[i].h, load);
+    }
+    run_jobs(fill_shard, job, jobs);
+    for(i = 0; i < jobs; i++){
+        htable_merge(h, job[i].h);
+        htable_free(job[i].h);
+    }
+    free(text);
+    free(job);
+}
+
+/**
+ * Reads a length of a stream from a command line argument: a number of
+ * words, or of seconds if it ends in 's'.
+ * @param arg the argument.
+ * @param seconds set to 1 for seconds, 0 for words.
+ * @return the length, or exits if it is not positive.
+ */
+static int parse_span(char *arg, int *seconds){
+    int n = atoi(arg);
+
+    *seconds = arg[0] != '\0' && arg[strlen(arg) - 1] == 's';
+    if(n <= 0){
+        fprintf(stderr, "Window and interval must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+/**
+ * Removes the oldest word from a window and one occurrence of it from
+ * the hash table.
+ * @param h the hash table.
+ * @param w the window, which must not be empty.
+ */
+static void window_expire(htable h, struct window *w){
+    htable_decrement(h, w->words[w->start]);
+    w->start = (w->start + 1) % w->size;
+    w->count--;
+}
+
+/**
+ * Adds a word to the newest end of a window, doubling its buffer if it
+ * is full.
+ * @param w the window.
+ * @param word the word, which is copied and must fit in WINDOW_WORD.
+ * @param now the time the word was read.
+ */
+static void window_push(struct window *w, char *word, time_t now){
+    int i;
+
+    if(w->count == w->size){
+        w->words = erealloc(w->words, 2 * w->size * sizeof w->words[0]);
+        w->times = erealloc(w->times, 2 * w->size * sizeof w->times[0]);
+        /* the words that wrapped round move up past the old end */
+        memcpy(w->words + w->size, w->words, w->start * sizeof w->words[0]);
+        memcpy(w->times + w->size, w->times, w->start * sizeof w->times[0]);
+        w->size *= 2;
+    }
+    i = (w->start + w->count++) % w->size;
+    strcpy(w->words[i], word);
+    w->times[i] = now;
+}
+
+/**
+ * Prints the most frequent words in the hash table, followed by a
+ * blank line, and sends them on at once.
+ * @param h the hash table.
+ * @param top the number of words to print.
+ * @param words room for top words.
+ * @param freqs room for top frequencies.
+ */
+static void print_snapshot(htable h, int top, char **words, int *freqs){
+    int n = htable_top(h, top, words, freqs);
+    int i;
+
+    for(i = 0; i < n; i++) print_info(freqs[i], words[i]);
+    writer_char(out, '\n');
+    writer_flush(out);
+}
+
+/**
+ * Counts the words of a stream that may never end, keeping in the hash
+ * table only the words of a window over its most recent stretch.  Each
+ * word read pushes those that have fallen out of the window back out
+ * of the table, so both stay bounded by the size of the window.  The
+ * most frequent words are printed at each interval and at the end of
+ * the stream.  Words are read as soon as they arrive, and time is only
+ * checked as each one does.
+ * @param h the hash table, which starts empty.
+ * @param stream the stream to read words from.
+ * @param span the length of the window.
+ * @param span_secs 1 if span is in seconds, 0 if in words.
+ * @param interval the length of stream between snapshots.
+ * @param interval_secs 1 if interval is in seconds, 0 if in words.
+ * @param top the number of words in each snapshot.
+ */
+static void count_window(htable h, FILE *stream, int span, int span_secs,
+                         int interval, int interval_secs, int top){
+    struct window w;
+    char **top_words = emalloc(top * sizeof top_words[0]);
+    int *top_freqs = emalloc(top * sizeof top_freqs[0]);
+    char word[WINDOW_WORD];
+    time_t now = 0;
+    time_t next = 0;
+    long count = 0;
+    int pending = 0;
+
+    /* the buffer grows as needed, up to the words in the window */
+    w.size = span_secs || span > 1024 ? 1024 : span;
+    w.words = emalloc(w.size * sizeof w.words[0]);
+    w.times = emalloc(w.size * sizeof w.times[0]);
+    w.start = 0;
+    w.count = 0;
+    if(span_secs || interval_secs) next = time(NULL) + interval;
+
+    out = writer_new(1);
+    while(getword(word, sizeof word, stream) != EOF){
+        if(span_secs || interval_secs) now = time(NULL);
+        if(span_secs){
+            while(w.count > 0 && now - w.times[w.start] >= span){
+                window_expire(h, &w);
+            }
+        } else if(w.count == span){
+            window_expire(h, &w);
+        }
+        if(htable_insert(h, word) == 0) table_full();
+        window_push(&w, word, now);
+        count++;
+        pending = 1;
+        if(interval_secs ? now >= next : count % interval == 0){
+            print_snapshot(h, top, top_words, top_freqs);
+            next = now + interval;
+            pending = 0;
+        }
+    }
+    if(pending) print_snapshot(h, top, top_words, top_freqs);
+    writer_free(out);
+
+    free(w.words);
+    free(w.times);
+    free(top_words);
+    free(top_freqs);
+}
+
+/**
+ * Looks up a batch of words and prints the ones that are not in the
+ * hash table.  Words that the Bloom filter rules out are never looked
+ * up in the hash table.
+ * @param h the hash table to search.
+ * @param b the Bloom filter of the hash table's words, or NULL.
+ * @param words the words to look up.
+ * @param n the number of words.
+ * @return the number of words that were not found.
+ */
+static int check_batch(htable h, bloom b, char **words, int n){
+    char *maybe[CHECK_BATCH];
+    int freqs[CHECK_BATCH];
+    int unknown = 0;
+    int m = 0;
+    int i, j;
+
+    for(i = 0; i < n; i++){
+        if(b == NULL || bloom_check(b, words[i])) maybe[m++] = words[i];
+    }
+    htable_search_batch(h, maybe, m, freqs);
+    for(i = 0, j = 0; i < n; i++){
+        /* words ruled out by the filter are missing from maybe */
+        if(j < m && maybe[j] == words[i] && freqs[j++] != 0) continue;
+        unknown++;
+        print_unknown(words[i]);
+    }
+    return unknown;
+}
 
 /**
  * Prints the help message.
@@ -29,15 +600,51 @@ static void print_help(){
     fprintf(stderr, "the hash table, before being printed out alongside\n");
     fprintf(stderr, "their frequencies to stdout.\n\n");
     fprintf(stderr, "Arguments:\n");
+    fprintf(stderr, " -a ORDER     Print the words sorted by ORDER: freq (most "
+"frequent\n              first) or alpha\n");
+    fprintf(stderr, " -b           Rule out unknown words with a Bloom filter "
+"(if -c\n              is used) and print its stats\n");
     fprintf(stderr, " -c FILENAME  Check spelling of words in FILENAME using "
-"words\n              from stdin as dictionary. Print unknown words to\n       "
-"       stdout, timing info & count to stderr (ignore -p) \n -d           Use "
-            "double hashing (linear probing is the default)\n");
-    fprintf(stderr," -e           Display entire "
-"contents of hash table on stderr\n -p           Print stats info instead"
-" of frequencies & words\n -s SNAPSHOTS Show SNAPSHOTS stats snapshots "
-"(if -p is used)\n -t TABLESIZE Use the first prime >= TABLESIZE as hash"
-" table size\n\n -h           Display this message\n");
+"words\n              from stdin as dictionary. Print unknown words to\n"
+"              stdout, timing info & count to stderr (ignore -p) \n");
+    fprintf(stderr, " -d           Use double hashing (linear probing is the "
+"default)\n");
+    fprintf(stderr, " -g           Use SIMD group probing over control "
+"bytes\n");
+    fprintf(stderr, " -i INTERVAL  Print the top words every INTERVAL words, "
+"or seconds\n              if it ends in s (if -x is used, default WINDOW)\n");
+    fprintf(stderr, " -r           Use Robin Hood hashing\n");
+    fprintf(stderr, " -e           Display entire contents of hash table on "
+"stderr\n");
+    fprintf(stderr, " -f HASH      Use the HASH hash function: 31 (the "
+"default),\n              fnv or murmur\n");
+    fprintf(stderr, " -j JOBS      Fill the hash table using JOBS threads\n");
+    fprintf(stderr, " -k NUMBER    Follow each unknown word with up to NUMBER "
+"of the\n              closest known words (if -c is used)\n");
+    fprintf(stderr, " -l LOAD      Grow the hash table once it is LOAD full\n"
+"              (more than 0 and less than 1, default 0.75)\n");
+    fprintf(stderr, " -m FILENAME  Map the hash table from snapshot FILENAME "
+"instead\n              of reading stdin (ignore -e & -p)\n");
+    fprintf(stderr, " -n NUMBER    Print only the NUMBER most frequent words, "
+"most\n              frequent first\n");
+    fprintf(stderr, " -p           Print stats info instead of frequencies & "
+"words\n");
+    fprintf(stderr, " -s SNAPSHOTS Show SNAPSHOTS stats snapshots (if -p is "
+"used)\n");
+    fprintf(stderr, " -t TABLESIZE Use the first prime >= TABLESIZE as hash "
+"table size\n");
+    fprintf(stderr, " -u           Have the -j threads all count into one "
+"shared hash\n              table, sized for the input (not with -r)\n");
+    fprintf(stderr, " -w FILENAME  Write a snapshot of the hash table to "
+"FILENAME\n");
+    fprintf(stderr, " -x WINDOW    Count only the last WINDOW words, or "
+"seconds if it\n              ends in s, of a stream that need not end, "
+"printing\n"
+"              the top words (see -i & -n, default 10) as it goes\n"
+"              (ignore all but -d -f -g -l -p -r -s -t -2)\n");
+    fprintf(stderr, " -2           Use the first power of two >= TABLESIZE "
+"instead\n");
+    fprintf(stderr, "\n -h           Display this message\n");
 
 }
 
@@ -49,14 +656,41 @@ static void print_help(){
  * read from stdin and added to the hash table, before being printed out
  * alongside their frequencies to stdout.
  *
+ * -a ORDER     Print the words sorted by ORDER: freq (most frequent
+ *              first) or alpha
+ * -b           Rule out unknown words with a Bloom filter (if -c
+ *              is used) and print its stats
  * -c FILENAME  Check spelling of words in FILENAME using words
  *              from stdin as dictionary.  Print unknown words to
  *              stdout, timing info & count to stderr (ignore -p)
  * -d           Use double hashing (linear probing is the default)
+ * -g           Use SIMD group probing over control bytes
+ * -i INTERVAL  Print the top words every INTERVAL words, or seconds
+ *              if it ends in s (if -x is used, default WINDOW)
+ * -r           Use Robin Hood hashing
  * -e           Display entire contents of hash table on stderr
+ * -f HASH      Use the HASH hash function: 31 (the default),
+ *              fnv or murmur
+ * -j JOBS      Fill the hash table using JOBS threads
+ * -k NUMBER    Follow each unknown word with up to NUMBER of the
+ *              closest known words (if -c is used)
+ * -l LOAD      Grow the hash table once it is LOAD full
+ *              (more than 0 and less than 1, default 0.75)
+ * -m FILENAME  Map the hash table from snapshot FILENAME instead
+ *              of reading stdin (ignore -e & -p)
+ * -n NUMBER    Print only the NUMBER most frequent words, most
+ *              frequent first
  * -p           Print stats info instead of frequencies & words
  * -s SNAPSHOTS Show SNAPSHOTS stats snapshots (if -p is used)
  * -t TABLESIZE Use the first prime >= TABLESIZE as htable size
+ * -u           Have the -j threads all count into one shared hash
+ *              table, sized for the input (not with -r)
+ * -w FILENAME  Write a snapshot of the hash table to FILENAME
+ * -x WINDOW    Count only the last WINDOW words, or seconds if it
+ *              ends in s, of a stream that need not end, printing
+ *              the top words (see -i & -n, default 10) as it goes
+ *              (ignore all but -d -f -g -l -p -r -s -t -2)
+ * -2           Use the first power of two >= TABLESIZE instead
  * 
  * -h           Display this message
  *
@@ -66,28 +700,49 @@ static void print_help(){
  */
 int main(int argc, char **argv){
     /* Timing variables. */
-    clock_t start, end;
+    double start, end;
     double fill = 0.0;
     double search = 0.0;
 
     /* Hashtable parameters. */
     htable h;
-    char word[256];
+    char *word;
+    tokenizer tok;
+    char batch[CHECK_BATCH][256];
+    char *words[CHECK_BATCH];
+    int n = 0;
     int unknown = 0;
     char option;
-    FILE *infile;
+    FILE *infile = NULL;
     hashing_t type = LINEAR_P;
+    sizing_t sizing = PRIME_SIZE;
+    hashfn_t hash_fn = WORD_31;
     int cap = 113;
+    double load = -1.0;
+    int jobs = 1;
     int snap = 0;
+    char *load_file = NULL;
+    char *save_file = NULL;
+    int top = 0;
+    int order = 0;
+    int window = 0;
+    int window_secs = 0;
+    int interval = 0;
+    int interval_secs = 0;
+    char **top_words;
+    int *top_freqs;
+    int i;
 
     /* Option variables. */
+    int b = 0;
     int c = 0;
     int e = 0;
     int p = 0;
     int s = 0;
+    int u = 0;
 
     /* Get options from the command line. */
-    const char *optstring = "c:deps:t:h";
+    const char *optstring = "a:bc:def:gi:j:k:l:m:n:prs:t:uw:x:2h";
     
     /* Switch case for each of the commands. */
     while((option = getopt(argc, argv, optstring)) != EOF){
@@ -96,17 +751,83 @@ int main(int argc, char **argv){
                 print_help();
                 exit(EXIT_FAILURE);
                 break;
+            case 'a':
+                if(strcmp(optarg, "freq") == 0){
+                    order = 'f';
+                } else if(strcmp(optarg, "alpha") == 0){
+                    order = 'a';
+                } else {
+                    print_help();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'b':
+                b = 1;
+                break;
             case 'd':
                 type = DOUBLE_H;
                 break;
+            case '2':
+                sizing = POW2_SIZE;
+                break;
+            case 'f':
+                if(strcmp(optarg, "31") == 0){
+                    hash_fn = WORD_31;
+                } else if(strcmp(optarg, "fnv") == 0){
+                    hash_fn = FNV_1A;
+                } else if(strcmp(optarg, "murmur") == 0){
+                    hash_fn = MURMUR_3;
+                } else {
+                    print_help();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'g':
+                type = GROUP_P;
+                break;
+            case 'r':
+                type = ROBIN_HOOD;
+                break;
+            case 'i':
+                interval = parse_span(optarg, &interval_secs);
+                break;
+            case 'x':
+                window = parse_span(optarg, &window_secs);
+                break;
+            case 'u':
+                u = 1;
+                break;
             case 'e':
                 e = 1;
                 break;
+            case 'j':
+                jobs = atoi(optarg);
+                break;
+            case 'k':
+                num_suggestions = atoi(optarg);
+                if(num_suggestions > MAX_SUGGESTIONS){
+                    num_suggestions = MAX_SUGGESTIONS;
+                }
+                break;
+            case 'l':
+                load = atof(optarg);
+                /* a table that fills up has nowhere to put new words */
+                if(load <= 0.0 || load >= 1.0){
+                    print_help();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'm':
+                load_file = optarg;
+                break;
             case 's':
                 s = atoi(optarg);
                 break;
             case 't':
-                cap = get_prime(atoi(optarg));
+                cap = atoi(optarg);
+                break;
+            case 'w':
+                save_file = optarg;
                 break;
             case 'c':
                 if(NULL == (infile = fopen(optarg, "r"))){
@@ -115,6 +836,9 @@ int main(int argc, char **argv){
                 }
                 c = 1;;
                 break;
+            case 'n':
+                top = atoi(optarg);
+                break;
             case 'p':
                 p = 1;;
                 break;
@@ -124,30 +848,97 @@ int main(int argc, char **argv){
         }
     }
 
-    h = htable_new(cap, type);
-      
+    /* If -s option is given, print given number of stats. */
+    if(s > 0) snap = s;
+
+    /* Threads sharing a table cannot move keys as Robin Hood does. */
+    if(u == 1 && type == ROBIN_HOOD){
+        fprintf(stderr, "A shared hash table can't use Robin Hood hashing\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Count a window over a stream, printing as it goes. */
+    if(window > 0){
+        h = htable_new(cap, type, sizing, hash_fn);
+        if(load >= 0.0) htable_set_max_load(h, load);
+        if(interval == 0){
+            interval = window;
+            interval_secs = window_secs;
+        }
+        count_window(h, stdin, window, window_secs, interval, interval_secs,
+                     top > 0 ? top : WINDOW_TOP);
+        if(p == 1) htable_print_stats(h, stdout, snap);
+        htable_free(h);
+        return EXIT_SUCCESS;
+    }
+
     /* Fill hashtable. */
-    start = clock();
-    while(getword(word, sizeof word, stdin) != EOF){
-        htable_insert(h, word);
+    start = now_seconds();
+    if(load_file != NULL){
+        if(NULL == (h = htable_load(load_file))){
+            fprintf(stderr, "Can't load snapshot '%s'\n", load_file);
+            exit(EXIT_FAILURE);
+        }
+        /* a mapped table only keeps its keys and frequencies */
+        e = 0;
+        p = 0;
+    } else if(u == 1 && jobs > 1){
+        h = shared_fill(stdin, jobs, cap, load, type, sizing, hash_fn);
+    } else {
+        h = htable_new(cap, type, sizing, hash_fn);
+        if(load >= 0.0) htable_set_max_load(h, load);
+        if(jobs > 1){
+            parallel_fill(h, stdin, jobs, cap, type, sizing, hash_fn,
+                          load);
+        } else {
+            tok = tokenizer_new(stdin, 256);
+            while(tokenizer_next(tok, &word) != EOF){
+                if(htable_insert(h, word) == 0) table_full();
+            }
+            tokenizer_free(tok);
+        }
+    }
+    /* These are built from the finished table, at its final size. */
+    if(b == 1 && c == 1){
+        filter = bloom_new(htable_size(h), BLOOM_BITS);
+        htable_print(h, add_to_filter);
+    }
+    if(num_suggestions > 0 && c == 1){
+        speller = suggest_new();
+        htable_print(h, add_to_speller);
     }
-    end = clock();
-    fill = (end-start)/(double)CLOCKS_PER_SEC;
+    end = now_seconds();
+    fill = end - start;
 
+    if(save_file != NULL && load_file == NULL && !htable_save(h, save_file)){
+        fprintf(stderr, "Can't write snapshot '%s'\n", save_file);
+        exit(EXIT_FAILURE);
+    }
 
     /* Search file for words in hashtable, print unknowns. */
     if(c == 1){
-        start = clock();
-        while(getword(word, sizeof word, infile) != EOF){
-            if(htable_search(h, word) == 0){
-                unknown++;
-                printf("%s\n", word);
+        start = now_seconds();
+        tok = tokenizer_new(infile, sizeof batch[0]);
+        while(tokenizer_next(tok, &word) != EOF){
+            /* Words only last until the next call, so copy them. */
+            strcpy(batch[n], word);
+            words[n] = batch[n];
+            if(++n == CHECK_BATCH){
+                unknown += check_batch(h, filter, words, n);
+                n = 0;
             }
         }
-        end = clock();
-        search = (end-start)/(double)CLOCKS_PER_SEC;
+        unknown += check_batch(h, filter, words, n);
+        tokenizer_free(tok);
+        end = now_seconds();
+        search = end - start;
         fprintf(stderr, "Fill time:    %.6f\nSearch time:  %.6f\n"
                 "Unknown words = %d\n", fill, search, unknown);
+        if(filter != NULL){
+            bloom_print_stats(filter, stderr, unknown);
+            bloom_free(filter);
+        }
+        if(speller != NULL) suggest_free(speller);
         fclose(infile);
         p = 0;
     }
@@ -159,12 +950,35 @@ int main(int argc, char **argv){
 
     /* If -p print stats info unless -c is given. */
     if(p == 1){
-        /* If -s option is given, print given number of stats. */
-        if(s > 0) snap = s;
-        
         htable_print_stats(h, stdout, snap); 
     } else if (c != 1){
-        htable_print(h, print_info);   
+        /* file descriptor 1 is stdout, written to without stdio */
+        out = writer_new(1);
+        if(top > 0){
+            top_words = emalloc(top * sizeof top_words[0]);
+            top_freqs = emalloc(top * sizeof top_freqs[0]);
+            n = htable_top(h, top, top_words, top_freqs);
+            for(i = 0; i < n; i++) print_info(top_freqs[i], top_words[i]);
+            free(top_words);
+            free(top_freqs);
+        } else if(order != 0){
+            entry_words = emalloc((htable_size(h) + 1) * sizeof entry_words[0]);
+            entry_freqs = emalloc((htable_size(h) + 1) * sizeof entry_freqs[0]);
+            htable_print(h, add_entry);
+            /* a stable sort by frequency keeps equal ones in word order */
+            radix_sort_words(entry_words, entry_freqs, num_entries);
+            if(order == 'f'){
+                radix_sort_freqs(entry_words, entry_freqs, num_entries);
+            }
+            for(i = 0; i < num_entries; i++){
+                print_info(entry_freqs[i], entry_words[i]);
+            }
+            free(entry_words);
+            free(entry_freqs);
+        } else {
+            htable_print(h, print_info);   
+        }
+        writer_free(out);
     }
 
     /* Free all memory. */
@@ -1,16 +1,127 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
+#include <limits.h>
 #include "mylib.h"
 #include "htable.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HTABLE_GROUP 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HTABLE_GROUP 16
+#else
+#define HTABLE_GROUP 16
+#endif
+
+/* Default load factor at which the table grows. */
+#define HTABLE_DEFAULT_LOAD 0.75
+
+/* Largest capacity a table is given, so slot counts fit in an int. */
+#define HTABLE_MAX_CAPACITY (1 << 30)
+
+/* Number of old slots migrated to the new table on each insert. */
+#define HTABLE_REHASH_STEP 16
+
+/* Control byte of an empty slot under group probing. */
+#define HTABLE_CTRL_EMPTY 0x80
+
+/* Control byte of a slot whose key was deleted, matching no hash. */
+#define HTABLE_CTRL_DELETED 0xfe
+
+/* Control byte of an occupied slot, the top seven bits of its hash. */
+#define HTABLE_CTRL(hash) ((unsigned char) ((hash) >> 25))
+
+/* Number of lookups htable_search_batch keeps in flight at once. */
+#define HTABLE_BATCH 16
+
+/* First bytes of a snapshot file, which change with its layout. */
+#define HTABLE_MAGIC "HTB1"
+
+/* A double hashed table is cleaned once this fraction of it is tombstones. */
+#define HTABLE_TOMBSTONE_LIMIT 4
+
+/* Nonzero if a slot's key pointer is a key, not empty or a tombstone. */
+#define HTABLE_HAS_KEY(key) ((key) != NULL && (key) != htable_tombstone)
+
+#if defined(__GNUC__)
+#define HTABLE_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define HTABLE_PREFETCH(p) ((void) 0)
+#endif
+
+/* Atomic operations on the slots of a table shared between threads. */
+#if defined(__GNUC__)
+#define HTABLE_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define HTABLE_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define HTABLE_CAS(p, old, new) __sync_bool_compare_and_swap(p, old, new)
+#define HTABLE_FETCH_ADD(p, n) __atomic_fetch_add(p, n, __ATOMIC_RELAXED)
+#else
+/* without atomics a shared table is only safe to use from one thread */
+#define HTABLE_LOAD(p) (*(p))
+#define HTABLE_STORE(p, v) (*(p) = (v))
+#define HTABLE_CAS(p, old, new) (*(p) == (old) ? (*(p) = (new), 1) : 0)
+#define HTABLE_FETCH_ADD(p, n) ((*(p) += (n)) - (n))
+#endif
+
+/*
+ * Key of a slot whose key was deleted from a table that cannot shift
+ * keys back into the gap, keeping the probe chains through it intact.
+ */
+static char htable_tombstone[1];
 
 struct htablerec{
     int num_keys;
+    /* tombstones in the current table, and keys ever deleted */
+    int num_tombstones;
+    int num_deleted;
     int capacity;
+    sizing_t sizing;
     int *freqs;
     int *stats;
+    unsigned int *hashes;
     char **keys;
+    unsigned char *ctrl;
     hashing_t method;
+    hashfn_t hash_fn;
+    unsigned int (*hash)(char *word);
+    double max_load;
+    /* storage for the key strings, and how much of it deleted keys hold */
+    arena strings;
+    size_t key_bytes;
+    size_t dead_bytes;
+    /* storage for the keys inserted by each thread sharing the table */
+    arena *shared;
+    int num_shared;
+    /* previous table, drained into the current one a few slots at a time */
+    int old_capacity;
+    int migrate_pos;
+    int *old_freqs;
+    unsigned int *old_hashes;
+    char **old_keys;
+    unsigned char *old_ctrl;
+    /* snapshot mapped by htable_load, or NULL */
+    char *image;
+    size_t image_len;
+    /* one more than each key's place in image_keys, or 0 for empty slots */
+    unsigned int *offsets;
+    char *image_keys;
+};
+
+/*
+ * Start of a snapshot file.  It is followed by the hash, frequency and
+ * key offset of each slot, then by the keys themselves, each with its
+ * '\0'.  Everything is in the byte order of the machine that wrote it.
+ */
+struct htable_header {
+    char magic[4];
+    unsigned int method;
+    unsigned int sizing;
+    unsigned int hash_fn;
+    unsigned int capacity;
+    unsigned int num_keys;
+    unsigned int key_bytes;
 };
 
 /**
@@ -24,7 +135,7 @@ struct htablerec{
  * @param percent_full - the point at which to show the data from.
  */
 static void print_stats_line(htable h, FILE *stream, int percent_full) {
-    int current_entries = h->capacity * percent_full / 100;
+    int current_entries = (int) ((long) h->capacity * percent_full / 100);
     double average_collisions = 0.0;
     int at_home = 0;
     int max_collisions = 0;
@@ -47,36 +158,6 @@ static void print_stats_line(htable h, FILE *stream, int percent_full) {
     }
 }
 
-/**
- * Prints out a table showing what the following attributes were like
- * at regular intervals (as determined by num_stats) while the
- * hashtable was being built.
- *
- * @li Percent At Home - how many keys were placed without a collision
- * occurring.
- * @li Average Collisions - how many collisions have occurred on
- *  average while placing all of the keys so far.
- * @li Maximum Collisions - the most collisions that have occurred
- * while placing a key.
- *
- * @param h the hashtable to print statistics summary from.
- * @param stream the stream to send output to.
- * @param num_stats the maximum number of statistical snapshots to print.
- */
-void htable_print_stats(htable h, FILE *stream, int num_stats) {
-    int i;
-
-    fprintf(stream, "\n%s\n\n", 
-            h->method == LINEAR_P ? "Linear Probing" : "Double Hashing"); 
-    fprintf(stream, "Percent   Current   Percent    Average      Maximum\n");
-    fprintf(stream, " Full     Entries   At Home   Collisions   Collisions\n");
-    fprintf(stream, "-----------------------------------------------------\n");
-    for (i = 1; i <= num_stats; i++) {
-        print_stats_line(h, stream, 100 * i / num_stats);
-    }
-    fprintf(stream, "-----------------------------------------------------\n\n");
-}
-
 
 /**
  * Calculates and returns an approprite index for hash table
@@ -94,35 +175,597 @@ static unsigned int htable_word_to_int(char *word){
     return index;
 }
 
+/**
+ * Calculates the 32-bit FNV-1a hash of a string.
+ * @param word the word to hash.
+ * @return the hash of word.
+ */
+static unsigned int htable_fnv1a(char *word){
+    unsigned int hash = 2166136261u;
+
+    while(*word != '\0'){
+        hash ^= (unsigned char) *word++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Rotates a 32-bit value left.
+ * @param x the value to rotate.
+ * @param r the number of bits to rotate by, between 1 and 31.
+ * @return the rotated value.
+ */
+static unsigned int htable_rotl(unsigned int x, int r){
+    return (x << r) | (x >> (32 - r));
+}
+
+/**
+ * Calculates the 32-bit MurmurHash3 of a string, which reads four
+ * bytes at a time and mixes every input bit into the whole result.
+ * @param word the word to hash.
+ * @return the hash of word.
+ */
+static unsigned int htable_murmur3(char *word){
+    const unsigned char *p = (const unsigned char *) word;
+    size_t len = strlen(word);
+    size_t n = len;
+    unsigned int hash = 0;
+    unsigned int k;
+
+    for(; n >= 4; n -= 4, p += 4){
+        k = p[0] | (unsigned int) p[1] << 8 | (unsigned int) p[2] << 16
+            | (unsigned int) p[3] << 24;
+        k = htable_rotl(k * 0xcc9e2d51u, 15) * 0x1b873593u;
+        hash = htable_rotl(hash ^ k, 13) * 5 + 0xe6546b64u;
+    }
+    k = 0;
+    switch(n){
+        case 3:
+            k ^= (unsigned int) p[2] << 16;
+            /* fall through */
+        case 2:
+            k ^= (unsigned int) p[1] << 8;
+            /* fall through */
+        case 1:
+            k ^= p[0];
+            hash ^= htable_rotl(k * 0xcc9e2d51u, 15) * 0x1b873593u;
+    }
+
+    hash ^= (unsigned int) len;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/**
+ * Picks the capacity of a table that must hold at least n slots: the
+ * first prime >= n, or the first power of two >= n, with n no more
+ * than HTABLE_MAX_CAPACITY.
+ * @param sizing the sizing policy of the table.
+ * @param n the smallest acceptable capacity.
+ * @return the capacity to use.
+ */
+static int htable_capacity(sizing_t sizing, long n){
+    int c = 1;
+
+    if(n > HTABLE_MAX_CAPACITY) n = HTABLE_MAX_CAPACITY;
+    if(sizing == PRIME_SIZE) return get_prime((int) n);
+    while(c < n) c *= 2;
+    return c;
+}
+
+/**
+ * Reduces a hash or index to a slot in a table, using a mask rather
+ * than a division when the capacity is a power of two.
+ * @param h the hash table.
+ * @param i the value to reduce.
+ * @param capacity the capacity of the table being probed.
+ * @return i modulo capacity.
+ */
+static unsigned int htable_wrap(htable h, unsigned int i, int capacity){
+    if(h->sizing == POW2_SIZE) return i & (capacity - 1);
+    return i % capacity;
+}
+
 /**
  * Calculates and returns the step used in double hashing
- * for given hash table and key index.
+ * for given table capacity and key hash.  The step depends only on the
+ * key, so with a prime capacity, or an odd step and a power of two
+ * capacity, the probe sequence visits every slot.
  * @param h the hash table.
- * @param i_key the index of the key for which a step will be calculated.
+ * @param capacity the capacity of the table being probed.
+ * @param hash the hash of the key for which a step will be calculated.
  * @return An integer value for the step used in double hashing.
  */
-static unsigned int htable_step(htable h, unsigned int i_key){
-    return 1 + (i_key % (h->capacity -1));
+static unsigned int htable_step(htable h, int capacity, unsigned int hash){
+    if(h->sizing == POW2_SIZE) return ((hash >> 7) & (capacity - 1)) | 1;
+    return 1 + (hash % (capacity -1));
+}
+
+/**
+ * Calculates how far the key in a slot sits from its home slot under
+ * linear probing.
+ * @param h the hash table.
+ * @param hash the hash of the key in the slot.
+ * @param index the index of the slot.
+ * @param capacity the capacity of the table.
+ * @return the number of collisions between home and index.
+ */
+static int htable_distance(htable h, unsigned int hash, int index,
+                           int capacity){
+    return htable_wrap(h, index + capacity - htable_wrap(h, hash, capacity),
+                       capacity);
+}
+
+/**
+ * Allocates the control bytes for a group probed table, all marked
+ * empty.  The first HTABLE_GROUP - 1 bytes are repeated past the end
+ * so that a group starting at any slot can be loaded in one go.
+ * @param capacity the capacity of the table.
+ * @return the control bytes.
+ */
+static unsigned char *htable_ctrl_new(int capacity){
+    unsigned char *ctrl = emalloc(capacity + HTABLE_GROUP - 1);
+
+    memset(ctrl, HTABLE_CTRL_EMPTY, capacity + HTABLE_GROUP - 1);
+    return ctrl;
+}
+
+/**
+ * Sets the control byte of a slot and of its copies past the end.
+ * @param ctrl the control bytes.
+ * @param capacity the capacity of the table.
+ * @param index the slot to set.
+ * @param c the new control byte.
+ */
+static void htable_ctrl_set(unsigned char *ctrl, int capacity, int index,
+                            unsigned char c){
+    for(; index < capacity + HTABLE_GROUP - 1; index += capacity){
+        ctrl[index] = c;
+    }
+}
+
+/**
+ * Compares each control byte in a group with the given byte.
+ * @param ctrl the first control byte of the group.
+ * @param c the byte to look for.
+ * @return a mask with bit i set if ctrl[i] equals c.
+ */
+static unsigned int htable_group_match(const unsigned char *ctrl,
+                                       unsigned char c){
+#if defined(__AVX2__)
+    __m256i group = _mm256_loadu_si256((const __m256i *) ctrl);
+    return (unsigned int) _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(group, _mm256_set1_epi8((char) c)));
+#elif defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+    return (unsigned int) _mm_movemask_epi8(
+        _mm_cmpeq_epi8(group, _mm_set1_epi8((char) c)));
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for(i = 0; i < HTABLE_GROUP; i++){
+        if(ctrl[i] == c) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * Returns the index of the lowest set bit of a non-zero mask.
+ * @param mask the mask.
+ * @return the index of its lowest set bit.
+ */
+static int htable_lowest_bit(unsigned int mask){
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+
+    while(!(mask & 1u)){
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+/**
+ * Probes a group probed table for given word, checking a whole group
+ * of slots at a time.  Slots whose control byte matches the word's
+ * fingerprint are compared by full hash and then by key; the search
+ * stops at the first group holding an empty slot.
+ * @param h the hash table.
+ * @param old nonzero to probe the old table instead of the current one.
+ * @param s the key to search for.
+ * @param hash the hash of s.
+ * @param collisions set to the number of slots between home and the
+ *        returned index.
+ * @param found set to 1 if s was found, 0 otherwise.
+ * @return the index holding the key, or the first empty slot, or -1
+ *         if every slot was visited without finding either.
+ */
+static int htable_probe_group(htable h, int old, char *s, unsigned int hash,
+                              int *collisions, int *found){
+    char **keys = old ? h->old_keys : h->keys;
+    unsigned int *hashes = old ? h->old_hashes : h->hashes;
+    unsigned char *ctrl = old ? h->old_ctrl : h->ctrl;
+    int capacity = old ? h->old_capacity : h->capacity;
+    int moved = old ? h->migrate_pos : 0;
+    int home = htable_wrap(h, hash, capacity);
+    int pos = home;
+    int probed;
+    unsigned int mask;
+    int index;
+
+    *found = 0;
+    for(probed = 0; probed < capacity; probed += HTABLE_GROUP){
+        mask = htable_group_match(ctrl + pos, HTABLE_CTRL(hash));
+        while(mask != 0){
+            index = htable_wrap(h, pos + htable_lowest_bit(mask), capacity);
+            if(hashes[index] == hash && index >= moved
+               && strcmp(keys[index], s) == 0){
+                *found = 1;
+                *collisions = htable_distance(h, hash, index, capacity);
+                return index;
+            }
+            mask &= mask - 1;
+        }
+        mask = htable_group_match(ctrl + pos, HTABLE_CTRL_EMPTY);
+        if(mask != 0){
+            index = htable_wrap(h, pos + htable_lowest_bit(mask), capacity);
+            *collisions = htable_distance(h, hash, index, capacity);
+            return index;
+        }
+        pos = htable_wrap(h, pos + HTABLE_GROUP, capacity);
+    }
+    *collisions = capacity;
+    return -1;
+}
+
+/**
+ * Probes the current or old table for given word one slot at a time
+ * using the table's hashing method.  Each slot's cached hash is compared
+ * first, so the key string is only read when the full hashes match.
+ * Old slots that have already been migrated are treated as occupied
+ * by some other key, which lets the old table be searched while it is
+ * being drained without breaking its probe chains.
+ * Robin Hood probing stops as soon as it reaches a key that is closer
+ * to its home slot than the word would be, since the word cannot lie
+ * beyond it.  Tombstones are passed over, but the first of them is
+ * where a missing word would be inserted.
+ * @param h the hash table.
+ * @param old nonzero to probe the old table instead of the current one.
+ * @param s the key to search for.
+ * @param hash the hash of s.
+ * @param collisions set to the number of collisions along the way.
+ * @param found set to 1 if s was found, 0 otherwise.
+ * @return the index holding the key, or the slot where it would be
+ *         inserted, or -1 if every slot was visited without finding
+ *         either.
+ */
+static int htable_probe_slots(htable h, int old, char *s,
+                              unsigned int hash, int *collisions,
+                              int *found){
+    char **keys = old ? h->old_keys : h->keys;
+    unsigned int *hashes = old ? h->old_hashes : h->hashes;
+    int capacity = old ? h->old_capacity : h->capacity;
+    int moved = old ? h->migrate_pos : 0;
+    unsigned int index = htable_wrap(h, hash, capacity);
+    unsigned int step = 1;
+    int tombstone = -1;
+    int tombstone_collisions = 0;
+
+    if(h->method == DOUBLE_H) step = htable_step(h, capacity, hash);
+    *collisions = 0;
+    *found = 0;
+    for(;;){
+        if(keys[index] == NULL) break;
+        if(hashes[index] == hash && (int) index >= moved
+           && keys[index] != htable_tombstone
+           && strcmp(keys[index], s) == 0){
+            *found = 1;
+            return index;
+        }
+        if(keys[index] == htable_tombstone && tombstone < 0){
+            tombstone = index;
+            tombstone_collisions = *collisions;
+        }
+        if(h->method == ROBIN_HOOD
+           && htable_distance(h, hashes[index], index, capacity) < *collisions){
+            return index;
+        }
+        
+        /* Double hashing steps by the key step, the others by one. */
+        index = htable_wrap(h, index + step, capacity);
+        (*collisions)++;
+        if(*collisions == capacity){
+            index = -1;
+            break;
+        }
+    }
+    if(tombstone >= 0){
+        *collisions = tombstone_collisions;
+        return tombstone;
+    }
+    return index;
+}
+
+/**
+ * Probes the current or old table for given word using the probe that
+ * suits the table's hashing method.
+ * @param h the hash table.
+ * @param old nonzero to probe the old table instead of the current one.
+ * @param s the key to search for.
+ * @param hash the hash of s.
+ * @param collisions set to the number of collisions along the way.
+ * @param found set to 1 if s was found, 0 otherwise.
+ * @return the index holding the key, or the slot where it would be
+ *         inserted, or -1 if the table is full.
+ */
+static int htable_probe(htable h, int old, char *s, unsigned int hash,
+                        int *collisions, int *found){
+    if(h->method == GROUP_P){
+        return htable_probe_group(h, old, s, hash, collisions, found);
+    }
+    return htable_probe_slots(h, old, s, hash, collisions, found);
+}
+
+/**
+ * Stores a key in the current table at the slot returned by
+ * htable_probe.  Under Robin Hood hashing the slot may hold a key that
+ * is closer to home, which is displaced further along, and so on until
+ * an empty slot is reached.  Under double hashing it may be a tombstone,
+ * which is reused.
+ * @param h the hash table.
+ * @param index the slot to store the key in.
+ * @param key the key to store.
+ * @param hash the hash of key.
+ * @param freq the frequency of key.
+ */
+static void htable_place(htable h, int index, char *key, unsigned int hash,
+                         int freq){
+    char *tmp_key;
+    unsigned int tmp_hash;
+    int tmp_freq;
+
+    while(HTABLE_HAS_KEY(h->keys[index])){
+        if(htable_distance(h, h->hashes[index], index, h->capacity)
+           < htable_distance(h, hash, index, h->capacity)){
+            tmp_key = h->keys[index];
+            tmp_hash = h->hashes[index];
+            tmp_freq = h->freqs[index];
+            h->keys[index] = key;
+            h->hashes[index] = hash;
+            h->freqs[index] = freq;
+            key = tmp_key;
+            hash = tmp_hash;
+            freq = tmp_freq;
+        }
+        index = htable_wrap(h, index + 1, h->capacity);
+    }
+    if(h->keys[index] == htable_tombstone) h->num_tombstones--;
+    h->keys[index] = key;
+    h->hashes[index] = hash;
+    h->freqs[index] = freq;
+    if(h->ctrl != NULL){
+        htable_ctrl_set(h->ctrl, h->capacity, index, HTABLE_CTRL(hash));
+    }
+}
+
+/**
+ * Moves up to n slots of the old table into the current one, freeing
+ * the old arrays once every slot has been moved.
+ * @param h the hash table being resized.
+ * @param n the maximum number of old slots to migrate.
+ */
+static void htable_rehash_step(htable h, int n){
+    int collisions;
+    int found;
+    int i;
+    int j;
+
+    while(h->old_keys != NULL && n-- > 0){
+        j = h->migrate_pos;
+        if(HTABLE_HAS_KEY(h->old_keys[j])){
+            i = htable_probe(h, 0, h->old_keys[j], h->old_hashes[j],
+                             &collisions, &found);
+            htable_place(h, i, h->old_keys[j], h->old_hashes[j],
+                         h->old_freqs[j]);
+        }
+        if(++h->migrate_pos == h->old_capacity){
+            free(h->old_keys);
+            free(h->old_freqs);
+            free(h->old_hashes);
+            free(h->old_ctrl);
+            h->old_keys = NULL;
+            h->old_freqs = NULL;
+            h->old_hashes = NULL;
+            h->old_ctrl = NULL;
+            h->old_capacity = 0;
+            h->migrate_pos = 0;
+        }
+    }
+}
+
+/**
+ * Prints the mean, variance and maximum of the number of collisions a
+ * search meets before finding each key currently in the table.  Unlike
+ * the per-insert stats these include keys displaced after insertion.
+ * @param h the hash table, with no resize in progress.
+ * @param stream the stream to print the summary to.
+ */
+static void print_probe_summary(htable h, FILE *stream){
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    double mean;
+    int max_collisions = 0;
+    int collisions;
+    int found;
+    int i;
+
+    if(h->num_keys == 0) return;
+    for(i = 0; i < h->capacity; i++){
+        if(HTABLE_HAS_KEY(h->keys[i])){
+            htable_probe(h, 0, h->keys[i], h->hashes[i], &collisions, &found);
+            sum += collisions;
+            sum_sq += (double) collisions * collisions;
+            if(collisions > max_collisions) max_collisions = collisions;
+        }
+    }
+    mean = sum / h->num_keys;
+    fprintf(stream, "Probe length: mean %.2f, variance %.2f, maximum %d\n",
+            mean, sum_sq / h->num_keys - mean * mean, max_collisions);
+}
+
+/**
+ * Prints how evenly the hash function spreads the keys over their home
+ * slots: the chi-squared statistic of the number of keys per home slot,
+ * which is about the capacity for a uniformly random hash and larger
+ * the more keys share home slots, and the longest run of occupied
+ * slots, which is what linear probing has to walk through.
+ * @param h the hash table, with no resize in progress.
+ * @param stream the stream to print the summary to.
+ */
+static void print_distribution(htable h, FILE *stream){
+    int *counts;
+    double expected = (double) h->num_keys / h->capacity;
+    double chi_sq = 0.0;
+    int longest = 0;
+    int run = 0;
+    int first = -1;
+    int i;
+
+    if(h->num_keys == 0) return;
+    counts = emalloc(h->capacity * sizeof counts[0]);
+    for(i = 0; i < h->capacity; i++){
+        counts[i] = 0;
+    }
+    for(i = 0; i < h->capacity; i++){
+        /* tombstones are walked through just like keys */
+        if(h->keys[i] != NULL){
+            if(h->keys[i] != htable_tombstone){
+                counts[htable_wrap(h, h->hashes[i], h->capacity)]++;
+            }
+            run++;
+        } else {
+            if(first < 0) first = run;
+            run = 0;
+        }
+        if(run > longest) longest = run;
+    }
+    /* a run at the end carries on into the run at the start */
+    if(first > 0 && run + first > longest) longest = run + first;
+    if(first < 0) longest = h->capacity;
+    for(i = 0; i < h->capacity; i++){
+        chi_sq += (counts[i] - expected) * (counts[i] - expected) / expected;
+    }
+    free(counts);
+    fprintf(stream, "Home slots:   chi-squared %.1f (about %d if uniform)\n",
+            chi_sq, h->capacity);
+    fprintf(stream, "Longest cluster: %d\n\n", longest);
+}
+
+/**
+ * Finishes any resize that is still in progress.
+ * @param h the hash table.
+ */
+static void htable_rehash_finish(htable h){
+    htable_rehash_step(h, h->old_capacity);
+}
+
+/**
+ * Replaces the key and frequency arrays with ones of the given size,
+ * roughly twice the size to grow the table or the same size to clear
+ * out its tombstones.  Existing keys are left in the old arrays and
+ * moved across by later calls to htable_rehash_step.
+ * @param h the hash table to resize.
+ * @param c the new capacity, no smaller than the current one.
+ */
+static void htable_resize(htable h, int c){
+    int i;
+
+    htable_rehash_finish(h);
+    h->old_keys = h->keys;
+    h->old_freqs = h->freqs;
+    h->old_hashes = h->hashes;
+    h->old_ctrl = h->ctrl;
+    h->old_capacity = h->capacity;
+    h->migrate_pos = 0;
+
+    h->capacity = c;
+    h->freqs = emalloc(c * sizeof h->freqs[0]);
+    h->keys = emalloc(c * sizeof h->keys[0]);
+    h->hashes = emalloc(c * sizeof h->hashes[0]);
+    h->ctrl = h->method == GROUP_P ? htable_ctrl_new(c) : NULL;
+    h->stats = erealloc(h->stats, c * sizeof h->stats[0]);
+    h->num_tombstones = 0;
+    for(i = 0; i < c; i++){
+        h->freqs[i] = 0;
+        h->keys[i] = NULL;
+    }
+    for(i = h->old_capacity; i < c; i++){
+        h->stats[i] = 0;
+    }
 }
 
 /**
  * Creates a new hash table with given size and hashing method.
- * @param c the capacity of the hash table.
- * @param t the type of hashing used, LINEAR_P for linear hashing
- * or DOUBLE_H for double hashing.
+ * The table grows automatically once it is HTABLE_DEFAULT_LOAD full,
+ * see htable_set_max_load.
+ * @param c the smallest capacity of the hash table.
+ * @param t the type of hashing used, LINEAR_P for linear hashing,
+ * DOUBLE_H for double hashing, ROBIN_HOOD for Robin Hood hashing or
+ * GROUP_P for SIMD group probing.
+ * @param s the sizing policy, PRIME_SIZE to use the first prime >= c
+ * or POW2_SIZE to use the first power of two >= c, both here and
+ * whenever the table grows.
+ * @param f the hash function, WORD_31 for the 31 * h polynomial,
+ * FNV_1A for 32-bit FNV-1a or MURMUR_3 for 32-bit MurmurHash3.
  * @return the newly created hash table.
  */
-htable htable_new(int c, hashing_t t){
+htable htable_new(int c, hashing_t t, sizing_t s, hashfn_t f){
+    static unsigned int (*hash_fns[])(char *word) = {
+        htable_word_to_int, htable_fnv1a, htable_murmur3
+    };
     int i;
     htable h = emalloc(sizeof *h);
 
+    c = htable_capacity(s, c);
     h->capacity = c;
+    h->sizing = s;
     h->num_keys = 0;
+    h->num_tombstones = 0;
+    h->num_deleted = 0;
     h->method = t;
+    h->hash_fn = f;
+    h->hash = hash_fns[f];
+    h->max_load = HTABLE_DEFAULT_LOAD;
+    h->strings = arena_new();
+    h->key_bytes = 0;
+    h->dead_bytes = 0;
+    h->shared = NULL;
+    h->num_shared = 0;
+    h->old_capacity = 0;
+    h->migrate_pos = 0;
+    h->old_freqs = NULL;
+    h->old_hashes = NULL;
+    h->old_keys = NULL;
+    h->old_ctrl = NULL;
+    h->image = NULL;
+    h->offsets = NULL;
+    h->image_keys = NULL;
 
-    h->freqs = emalloc(c * sizeof h->freqs);
-    h->keys = emalloc(c * sizeof h->keys);
-    h->stats = emalloc(c * sizeof h->stats);
+    h->freqs = emalloc(c * sizeof h->freqs[0]);
+    h->keys = emalloc(c * sizeof h->keys[0]);
+    h->hashes = emalloc(c * sizeof h->hashes[0]);
+    h->ctrl = t == GROUP_P ? htable_ctrl_new(c) : NULL;
+    h->stats = emalloc(c * sizeof h->stats[0]);
 
     for(i = 0; i < c; i++){
         h->freqs[i] = 0;
@@ -133,59 +776,473 @@ htable htable_new(int c, hashing_t t){
     return h;
 }
 
+/**
+ * Prints out a table showing what the following attributes were like
+ * at regular intervals (as determined by num_stats) while the
+ * hashtable was being built.
+ *
+ * @li Percent At Home - how many keys were placed without a collision
+ * occurring.
+ * @li Average Collisions - how many collisions have occurred on
+ *  average while placing all of the keys so far.
+ * @li Maximum Collisions - the most collisions that have occurred
+ * while placing a key.
+ *
+ * Once keys have been deleted each row describes the latest insert to
+ * take the table to that many keys, and the number of deletions and of
+ * tombstones still in the table is shown beneath.
+ *
+ * This is followed by the spread of probe lengths for the keys as
+ * they now sit in the table, and by how evenly the hash function
+ * spreads them over their home slots.
+ *
+ * @param h the hashtable to print statistics summary from, which is
+ *        skipped if it was loaded, as no statistics are saved.
+ * @param stream the stream to send output to.
+ * @param num_stats the maximum number of statistical snapshots to print.
+ */
+void htable_print_stats(htable h, FILE *stream, int num_stats) {
+    static const char *names[] = {
+        "Linear Probing", "Double Hashing", "Robin Hood Hashing",
+        "SIMD Group Probing"
+    };
+    static const char *hash_names[] = {"31 * h", "FNV-1a", "MurmurHash3"};
+    int i;
+
+    if(h->image != NULL) return;
+    htable_rehash_finish(h);
+    fprintf(stream, "\n%s, %s hash\n\n", names[h->method],
+            hash_names[h->hash_fn]); 
+    fprintf(stream, "Percent   Current   Percent    Average      Maximum\n");
+    fprintf(stream, " Full     Entries   At Home   Collisions   Collisions\n");
+    fprintf(stream, "-----------------------------------------------------\n");
+    for (i = 1; i <= num_stats; i++) {
+        print_stats_line(h, stream, 100 * i / num_stats);
+    }
+    fprintf(stream,
+            "-----------------------------------------------------\n\n");
+    if(h->num_deleted > 0){
+        fprintf(stream, "Deleted keys: %d, tombstones left %d\n",
+                h->num_deleted, h->num_tombstones);
+    }
+    print_probe_summary(h, stream);
+    print_distribution(h, stream);
+}
+
+/**
+ * Sets the load factor at which the hash table grows.  It must be more
+ * than 0 and less than 1, so the table always grows before it is full.
+ * @param h the hash table.
+ * @param load the fraction of slots in use that triggers a resize.
+ */
+void htable_set_max_load(htable h, double load){
+    assert(load > 0.0 && load < 1.0);
+    h->max_load = load;
+}
+
+/**
+ * Returns the number of distinct keys in the hash table.
+ * @param h the hash table.
+ * @return the number of keys.
+ */
+int htable_size(htable h){
+    return h->num_keys;
+}
+
 /**
  * Frees all memory associated with given hash table.
  * @param h The hash table to be freed.
  */
 void htable_free(htable h){
-    int i;
-    
-    for(i = 0; i < h->capacity; i++){
-        if(h->keys[i] != NULL) free(h->keys[i]);
+    if(h->image != NULL){
+        /* the arrays all live in the mapping */
+        unmap_file(h->image, h->image_len);
+        free(h);
+        return;
     }
-    
+    arena_free(h->strings);
+    while(h->num_shared > 0) arena_free(h->shared[--h->num_shared]);
+    free(h->shared);
+    free(h->old_keys);
+    free(h->old_freqs);
+    free(h->old_hashes);
+    free(h->old_ctrl);
+    free(h->ctrl);
     free(h->stats);
+    free(h->hashes);
     free(h->keys);
     free(h->freqs);
     free(h);
 }
 
 /**
- * Inserts a key into given hash table.
+ * Adds count occurrences of a key to given hash table, growing the
+ * table first if the new key would take it past its maximum load.
+ * @param h the hash table that the key will be added to.
+ * @param s the key to be added.
+ * @param count the number of occurrences to add.
+ * @return 1- if the key was successfully inserted,
+ *         0- if the hash table if full or was loaded, so the key cannot
+ *         be inserted,
+ *         the new frequency of the key - if it was already present.
+ */
+static int htable_add(htable h, char *s, int count){
+    unsigned int hash = h->hash(s);
+    int collisions;
+    int found;
+    int index;
+    char *key;
+
+    if(h->image != NULL) return 0;
+    /* Spread the cost of any resize across inserts. */
+    htable_rehash_step(h, HTABLE_REHASH_STEP);
+
+    /* Keys not yet migrated are counted where they are. */
+    if(h->old_keys != NULL){
+        index = htable_probe(h, 1, s, hash, &collisions, &found);
+        if(found){
+            h->old_freqs[index] += count;
+            return h->old_freqs[index];
+        }
+    }
+
+    index = htable_probe(h, 0, s, hash, &collisions, &found);
+    /* If the same key is found, increment frequency at that index. */
+    if(found){
+        h->freqs[index] += count;
+        return h->freqs[index];
+    }
+
+    /* Tombstones lengthen probes just as keys do. */
+    if(h->num_keys + h->num_tombstones + 1 > h->max_load * h->capacity){
+        /* Clearing out enough tombstones makes room without growing. */
+        if(h->num_tombstones * HTABLE_TOMBSTONE_LIMIT * 2 >= h->capacity){
+            htable_resize(h, h->capacity);
+        } else if(h->capacity < HTABLE_MAX_CAPACITY){
+            htable_resize(h, htable_capacity(h->sizing, 2L * h->capacity));
+        }
+        index = htable_probe(h, 0, s, hash, &collisions, &found);
+    }
+    /* Return 0 if the table is full, which only a table at its largest
+       capacity can be. */
+    if(index < 0 || h->num_keys == h->capacity) return 0;
+
+    key = arena_strdup(h->strings, s);
+    h->key_bytes += strlen(s) + 1;
+    htable_place(h, index, key, hash, count);
+    h->stats[h->num_keys] = collisions;
+    h->num_keys++;
+    return 1;
+}
+
+/**
+ * Inserts a key into given hash table, growing the table first if the
+ * new key would take it past its maximum load.
  * @param h the hash table that the key will be inserted into.
  * @param s the key to be inserted.
  * @return 1- if the key was successfully inserted,
- *         0- if the hash table if full and the key cannot be inserted,
+ *         0- if the hash table if full or was loaded, so the key cannot
+ *         be inserted,
  *         the frequency of key insertion - if the key has already been
  *         inserted.
  */
 int htable_insert(htable h, char *s){
-    unsigned int index = htable_word_to_int(s) % h->capacity;
-    int collisions = 0;
+    return htable_add(h, s, 1);
+}
 
-    /* Until capacity number of collisions, keep trying to insert. */
+/**
+ * Empties a slot of the current table, shifting back into the gap any
+ * later key of the same run whose home slot does not lie between the
+ * gap and the key, and so on along the run.  Every key is then still
+ * reached from its home without passing an empty slot, as linear,
+ * Robin Hood and group probing need.
+ * @param h the hash table, which must not be double hashed.
+ * @param gap the slot to empty.
+ */
+static void htable_shift_back(htable h, int gap){
+    int index = gap;
+
+    h->keys[gap] = NULL;
     for(;;){
-        /* If the space is unoccupied, insert key here. */
-        if(h->keys[index] == NULL){
-            h->keys[index] = emalloc((strlen(s)+1) * sizeof h->keys[0][0]);
-            strcpy(h->keys[index], s);
-            h->freqs[index]++;
-	    h->stats[h->num_keys] = collisions;
-	    h->num_keys++;
-            return 1;
-            /* If the same key is found, increment frequency at that index. */
-        } else if(strcmp(h->keys[index],s) == 0){
-            h->freqs[index]++;
-            return h->freqs[index];
+        index = htable_wrap(h, index + 1, h->capacity);
+        if(h->keys[index] == NULL) break;
+        if(htable_distance(h, h->hashes[index], index, h->capacity)
+           >= (int) htable_wrap(h, index + h->capacity - gap, h->capacity)){
+            h->keys[gap] = h->keys[index];
+            h->hashes[gap] = h->hashes[index];
+            h->freqs[gap] = h->freqs[index];
+            if(h->ctrl != NULL){
+                htable_ctrl_set(h->ctrl, h->capacity, gap, h->ctrl[index]);
+            }
+            gap = index;
+            h->keys[gap] = NULL;
+        }
+    }
+    h->freqs[gap] = 0;
+    if(h->ctrl != NULL){
+        htable_ctrl_set(h->ctrl, h->capacity, gap, HTABLE_CTRL_EMPTY);
+    }
+}
+
+/**
+ * Copies the keys still in the table into a new arena and frees the old
+ * one, giving back the space taken by deleted keys.
+ * @param h the hash table.
+ */
+static void htable_compact_keys(htable h){
+    arena strings = arena_new();
+    int i;
+
+    htable_rehash_finish(h);
+    for(i = 0; i < h->capacity; i++){
+        if(HTABLE_HAS_KEY(h->keys[i])){
+            h->keys[i] = arena_strdup(strings, h->keys[i]);
         }
-        /* Choose probing method */
-        if(h->method == LINEAR_P) index++;
-	if(h->method == DOUBLE_H) index += htable_step(h, index);
-        index %= h->capacity;
-	collisions++;
-        /* Return 0 if capacity number of collisions. */
-        if(collisions == h->capacity) return 0;
-    }   
+    }
+    arena_free(h->strings);
+    while(h->num_shared > 0) arena_free(h->shared[--h->num_shared]);
+    h->strings = strings;
+    h->key_bytes -= h->dead_bytes;
+    h->dead_bytes = 0;
+}
+
+/**
+ * Removes a key from given hash table.  Under double hashing the key
+ * is replaced by a tombstone, which searches pass over and inserts
+ * reuse, and the table is rebuilt at the same size once one slot in
+ * HTABLE_TOMBSTONE_LIMIT is a tombstone.  The other methods shift
+ * later keys back into the gap instead, leaving no tombstone.  The
+ * keys are copied into fresh storage once deleted keys take up more
+ * space than the keys left and the table's slots together, so a table
+ * that keeps changing stays in bounded memory.
+ * @param h the hash table, which must not have been loaded.
+ * @param s the key to remove.
+ * @return the frequency the key had, or 0 if it was not in the table.
+ */
+int htable_delete(htable h, char *s){
+    unsigned int hash = h->hash(s);
+    int collisions;
+    int found;
+    int index;
+    int freq;
+
+    if(h->image != NULL) return 0;
+    htable_rehash_step(h, HTABLE_REHASH_STEP);
+
+    /* Keys not yet migrated are left as tombstones that are never moved. */
+    if(h->old_keys != NULL){
+        index = htable_probe(h, 1, s, hash, &collisions, &found);
+        if(found){
+            freq = h->old_freqs[index];
+            h->dead_bytes += strlen(h->old_keys[index]) + 1;
+            h->old_keys[index] = htable_tombstone;
+            h->old_freqs[index] = 0;
+            if(h->old_ctrl != NULL){
+                htable_ctrl_set(h->old_ctrl, h->old_capacity, index,
+                                HTABLE_CTRL_DELETED);
+            }
+            h->num_keys--;
+            h->num_deleted++;
+            return freq;
+        }
+    }
+
+    index = htable_probe(h, 0, s, hash, &collisions, &found);
+    if(!found) return 0;
+    freq = h->freqs[index];
+    h->dead_bytes += strlen(h->keys[index]) + 1;
+    if(h->method == DOUBLE_H){
+        h->keys[index] = htable_tombstone;
+        h->freqs[index] = 0;
+        h->num_tombstones++;
+    } else {
+        htable_shift_back(h, index);
+    }
+    h->num_keys--;
+    h->num_deleted++;
+    if(h->num_tombstones * HTABLE_TOMBSTONE_LIMIT > h->capacity){
+        htable_resize(h, h->capacity);
+    }
+    if(h->dead_bytes > h->key_bytes - h->dead_bytes + h->capacity){
+        htable_compact_keys(h);
+    }
+    return freq;
+}
+
+/**
+ * Removes one occurrence of a key from given hash table, deleting the
+ * key once it has none left.
+ * @param h the hash table, which must not have been loaded.
+ * @param s the key to remove an occurrence of.
+ * @return the frequency the key is left with, or 0 if it was deleted
+ *         or was not in the table.
+ */
+int htable_decrement(htable h, char *s){
+    unsigned int hash = h->hash(s);
+    int collisions;
+    int found;
+    int index;
+
+    if(h->image != NULL) return 0;
+    if(h->old_keys != NULL){
+        index = htable_probe(h, 1, s, hash, &collisions, &found);
+        if(found && h->old_freqs[index] > 1) return --h->old_freqs[index];
+    }
+    index = htable_probe(h, 0, s, hash, &collisions, &found);
+    if(found && h->freqs[index] > 1) return --h->freqs[index];
+    htable_delete(h, s);
+    return 0;
+}
+
+/**
+ * Adds every key in one hash table to another, along with its
+ * frequency.
+ * @param h the hash table to add the keys to, which must not have been
+ *        loaded.
+ * @param from the hash table to take the keys from, left unchanged
+ *        apart from finishing any resize in progress.
+ */
+void htable_merge(htable h, htable from){
+    int i;
+
+    if(from->image != NULL){
+        for(i = 0; i < from->capacity; i++){
+            if(from->offsets[i] != 0){
+                htable_add(h, from->image_keys + from->offsets[i] - 1,
+                           from->freqs[i]);
+            }
+        }
+        return;
+    }
+    htable_rehash_finish(from);
+    for(i = 0; i < from->capacity; i++){
+        if(HTABLE_HAS_KEY(from->keys[i])){
+            htable_add(h, from->keys[i], from->freqs[i]);
+        }
+    }
+}
+
+/**
+ * Gets a hash table ready to be shared by a number of threads, which
+ * may then call htable_insert_shared and htable_search_shared at the
+ * same time, but nothing else, until they have all finished.  A shared
+ * table keeps its size, so it should be made large enough for every
+ * key first, and it must not use Robin Hood hashing, which moves keys
+ * that other threads may be reading.  Afterwards it is an ordinary
+ * table again.
+ * @param h the hash table, which must not use Robin Hood hashing.
+ * @param threads the number of threads that will share it.
+ */
+void htable_share(htable h, int threads){
+    int i;
+
+    assert(h->method != ROBIN_HOOD);
+    htable_rehash_finish(h);
+    if(threads > h->num_shared){
+        h->shared = erealloc(h->shared, threads * sizeof h->shared[0]);
+        for(i = h->num_shared; i < threads; i++) h->shared[i] = arena_new();
+        h->num_shared = threads;
+    }
+    /* a claimed slot's hash reads 0 until it has been stored */
+    for(i = 0; i < h->capacity; i++){
+        if(h->keys[i] == NULL) h->hashes[i] = 0;
+    }
+}
+
+/**
+ * Inserts a key into a hash table that other threads may be inserting
+ * into or searching at the same time, see htable_share.  An empty slot
+ * is claimed by swapping its key pointer from NULL to a copy of the key
+ * with compare-and-swap, after which its hash is stored.  A thread that
+ * loses the race for a slot goes on to compare the key that won it,
+ * reading the key whenever the hash has not been stored yet, and
+ * frequencies are bumped with atomic adds, so no thread ever waits for
+ * another.  A new key is turned away once the table reaches its maximum
+ * load, less a slot for each thread that may be claiming one at the
+ * same moment, so the caller can count it somewhere else.
+ * @param h the hash table.
+ * @param thread the number of the calling thread, from 0 up to one less
+ *        than the number given to htable_share, and not used by any
+ *        other thread at the same time.
+ * @param s the key to be inserted.
+ * @return 1- if the key was successfully inserted,
+ *         0- if the hash table is at its maximum load and the key cannot
+ *         be inserted,
+ *         the frequency of key insertion - if the key has already been
+ *         inserted.
+ */
+int htable_insert_shared(htable h, int thread, char *s){
+    unsigned int hash = h->hash(s);
+    unsigned int index = htable_wrap(h, hash, h->capacity);
+    unsigned int step = 1;
+    unsigned int slot_hash;
+    char *copy = NULL;
+    char *key;
+    int collisions;
+
+    if(h->method == DOUBLE_H) step = htable_step(h, h->capacity, hash);
+    for(collisions = 0; collisions < h->capacity; collisions++){
+        key = HTABLE_LOAD(&h->keys[index]);
+        if(key == NULL){
+            if(HTABLE_LOAD(&h->num_keys) + h->num_shared
+               > h->max_load * h->capacity){
+                return 0;
+            }
+            /* a copy that loses the race is kept for the next empty slot */
+            if(copy == NULL) copy = arena_strdup(h->shared[thread], s);
+            if(HTABLE_CAS(&h->keys[index], (char *) NULL, copy)){
+                HTABLE_STORE(&h->hashes[index], hash);
+                if(h->ctrl != NULL){
+                    htable_ctrl_set(h->ctrl, h->capacity, index,
+                                    HTABLE_CTRL(hash));
+                }
+                HTABLE_FETCH_ADD(&h->freqs[index], 1);
+                HTABLE_FETCH_ADD(&h->key_bytes, strlen(s) + 1);
+                h->stats[HTABLE_FETCH_ADD(&h->num_keys, 1)] = collisions;
+                return 1;
+            }
+            key = HTABLE_LOAD(&h->keys[index]);
+        }
+        slot_hash = HTABLE_LOAD(&h->hashes[index]);
+        if((slot_hash == hash || slot_hash == 0) && key != htable_tombstone
+           && strcmp(key, s) == 0){
+            return HTABLE_FETCH_ADD(&h->freqs[index], 1) + 1;
+        }
+        index = htable_wrap(h, index + step, h->capacity);
+    }
+    return 0;
+}
+
+/**
+ * Searches a hash table that other threads may be inserting into at the
+ * same time, see htable_share.  The search looks at each slot at most
+ * once and never retries, so it finishes in a bounded number of steps
+ * whatever the other threads do.  A key whose insert has not finished
+ * may or may not be found.
+ * @param h the hash table.
+ * @param s the key to search for.
+ * @return the frequency of the key, or 0 if it is not found.
+ */
+int htable_search_shared(htable h, char *s){
+    unsigned int hash = h->hash(s);
+    unsigned int index = htable_wrap(h, hash, h->capacity);
+    unsigned int step = 1;
+    unsigned int slot_hash;
+    char *key;
+    int collisions;
+
+    if(h->method == DOUBLE_H) step = htable_step(h, h->capacity, hash);
+    for(collisions = 0; collisions < h->capacity; collisions++){
+        key = HTABLE_LOAD(&h->keys[index]);
+        if(key == NULL) return 0;
+        slot_hash = HTABLE_LOAD(&h->hashes[index]);
+        if((slot_hash == hash || slot_hash == 0) && key != htable_tombstone
+           && strcmp(key, s) == 0){
+            return HTABLE_LOAD(&h->freqs[index]);
+        }
+        index = htable_wrap(h, index + step, h->capacity);
+    }
+    return 0;
 }
 
 /**
@@ -196,28 +1253,137 @@ int htable_insert(htable h, char *s){
 void htable_print(htable h, void f(int freq, char *word)){
     int i;
     
+    if(h->image != NULL){
+        for(i = 0; i < h->capacity; i++){
+            if(h->offsets[i] != 0){
+                f(h->freqs[i], h->image_keys + h->offsets[i] - 1);
+            }
+        }
+        return;
+    }
+    htable_rehash_finish(h);
     for(i = 0; i < h->capacity; i++){
         if (h->freqs[i] != 0) f(h->freqs[i], h->keys[i]);
     }
 }
 
+/**
+ * Finds the k most frequent keys in the hash table with a bounded heap,
+ * in O(n log k) rather than sorting every key.
+ * @param h The hash table.
+ * @param k The largest number of keys wanted.
+ * @param words Set to the keys, most frequent first, with ties in
+ *        alphabetical order.  There must be room for k.
+ * @param freqs Set to the frequency of each key, with room for k.
+ * @return the number of keys found, which is k unless the table holds
+ *         fewer keys.
+ */
+int htable_top(htable h, int k, char **words, int *freqs){
+    int n = 0;
+    int i;
+
+    if(h->image != NULL){
+        for(i = 0; i < h->capacity; i++){
+            if(h->offsets[i] != 0){
+                n = topk_add(words, freqs, n, k,
+                             h->image_keys + h->offsets[i] - 1, h->freqs[i]);
+            }
+        }
+    } else {
+        htable_rehash_finish(h);
+        for(i = 0; i < h->capacity; i++){
+            if(HTABLE_HAS_KEY(h->keys[i])){
+                n = topk_add(words, freqs, n, k, h->keys[i], h->freqs[i]);
+            }
+        }
+    }
+    topk_sort(words, freqs, n);
+    return n;
+}
+
 /**
  * Prints the entire contents of the hash table including
  * frequencies, stats, and keys.
- * @param h The hash table.
+ * @param h The hash table, which is skipped if it was loaded.
  */
 void htable_print_entire_htable(htable h){
+    /* file descriptor 2 is stderr, which stdio does not buffer */
+    writer w;
     int i;
-    fprintf(stderr, "  Pos  Freq  Stats  Word\n ---------\
+
+    if(h->image != NULL) return;
+    w = writer_new(2);
+    htable_rehash_finish(h);
+    writer_str(w, "  Pos  Freq  Stats  Word\n ---------\
 -------------------------------\n");
     for(i = 0; i < h->capacity; i++){
-        if(h->keys[i] != NULL){
-            fprintf(stderr,"%5d %5d %5d   %s\n",
-                    i, h->freqs[i], h->stats[i], h->keys[i]);
-        } else {
-            fprintf(stderr,"%5d %5d %5d\n", i, h->freqs[i], h->stats[i]);
-	}
+        writer_int(w, i, 5);
+        writer_char(w, ' ');
+        writer_int(w, h->freqs[i], 5);
+        writer_char(w, ' ');
+        writer_int(w, h->stats[i], 5);
+        if(HTABLE_HAS_KEY(h->keys[i])){
+            writer_str(w, "   ");
+            writer_str(w, h->keys[i]);
+        }
+        writer_char(w, '\n');
+    }
+    writer_free(w);
+}
+
+/**
+ * Finds the frequency of a key whose hash is already known.
+ * @param h The hash table to be searched.
+ * @param word The key to search for.
+ * @param hash The hash of word.
+ * @return the frequency of the key, or 0 if it is not found.
+ */
+static int htable_lookup(htable h, char *word, unsigned int hash){
+    int collisions;
+    int found;
+    int index;
+
+    if(h->old_keys != NULL){
+        index = htable_probe(h, 1, word, hash, &collisions, &found);
+        if(found) return h->old_freqs[index];
     }
+
+    index = htable_probe(h, 0, word, hash, &collisions, &found);
+    /* If the key is found, return its frequency. */
+    if(found) return h->freqs[index];
+    return 0;
+}
+
+/**
+ * Finds the frequency of a key in a table loaded by htable_load, whose
+ * keys are found through their offsets.  Each method's keys lie along
+ * the same slot by slot sequence that htable_probe_slots follows, and
+ * group probing places keys as linear probing does.
+ * @param h The hash table to be searched.
+ * @param word The key to search for.
+ * @param hash The hash of word.
+ * @return the frequency of the key, or 0 if it is not found.
+ */
+static int htable_image_lookup(htable h, char *word, unsigned int hash){
+    unsigned int index = htable_wrap(h, hash, h->capacity);
+    unsigned int step = 1;
+    int collisions;
+
+    if(h->method == DOUBLE_H) step = htable_step(h, h->capacity, hash);
+    for(collisions = 0; collisions < h->capacity; collisions++){
+        if(h->offsets[index] == 0) return 0;
+        if(h->hashes[index] == hash
+           && strcmp(h->image_keys + h->offsets[index] - 1, word) == 0){
+            return h->freqs[index];
+        }
+        if(h->method == ROBIN_HOOD
+           && htable_distance(h, h->hashes[index], index, h->capacity)
+              < collisions){
+            return 0;
+        }
+        index = htable_wrap(h, index + step, h->capacity);
+    }
+    return 0;
 }
 
 /**
@@ -228,37 +1394,179 @@ void htable_print_entire_htable(htable h){
  *         If the key is found then the frequency of the key is returned.
  */
 int htable_search(htable h, char *word){
-    int collisions = 0;
-    int index = htable_word_to_int(word) % h->capacity;
+    if(h->image != NULL) return htable_image_lookup(h, word, h->hash(word));
+    return htable_lookup(h, word, h->hash(word));
+}
 
-    for(;;){
-        /* If that key doesn't exist in the table, break loop */
-        if(h->keys[index] == NULL){
-            index ++;
-            break;
-        }
-        /* If the key is found, return the index of it. */
-        if(strcmp(h->keys[index], word) == 0) return h->freqs[index];
-        
-        /* Depending on hashing method, increment index accordingly */
-        if(h->method == LINEAR_P) index++;
-	if(h->method == DOUBLE_H) index += htable_step(h, index);
-        
-	collisions++;
-        index %= h->capacity;
+/**
+ * Searches the hash table for each of a batch of keys.  All of the
+ * keys are hashed and their home slots prefetched before any probing
+ * starts, so the cache misses of different lookups overlap.
+ * @param h The hash table to be searched.
+ * @param words The keys to search for.
+ * @param n The number of keys in words.
+ * @param out Set to the frequency of each key, or 0 if it is not found.
+ */
+void htable_search_batch(htable h, char **words, int n, int *out){
+    unsigned int hashes[HTABLE_BATCH];
+    unsigned int home;
+    int m;
+    int i;
 
-        /* Break the loop if key not found after searching  whole table */
-        if(collisions == h->capacity) break;
+    if(h->image != NULL){
+        for(i = 0; i < n; i++) out[i] = htable_search(h, words[i]);
+        return;
+    }
+    for(; n > 0; n -= m, words += m, out += m){
+        m = n < HTABLE_BATCH ? n : HTABLE_BATCH;
+        for(i = 0; i < m; i++){
+            hashes[i] = h->hash(words[i]);
+            home = htable_wrap(h, hashes[i], h->capacity);
+            HTABLE_PREFETCH(&h->hashes[home]);
+            HTABLE_PREFETCH(&h->keys[home]);
+            if(h->ctrl != NULL) HTABLE_PREFETCH(&h->ctrl[home]);
+        }
+        /* A home slot with the right hash almost always holds the key. */
+        for(i = 0; i < m; i++){
+            home = htable_wrap(h, hashes[i], h->capacity);
+            if(h->keys[home] != NULL && h->hashes[home] == hashes[i]){
+                HTABLE_PREFETCH(h->keys[home]);
+            }
+        }
+        for(i = 0; i < m; i++){
+            out[i] = htable_lookup(h, words[i], hashes[i]);
+        }
     }
-    return 0;
 }
 
+/**
+ * Writes a snapshot of the hash table to a file, from which htable_load
+ * can map it straight back into memory.  The snapshot holds each slot's
+ * hash, frequency and key offset, and the keys, with no pointers.  Its
+ * fields are 32 bits, so a table whose keys take up 4 GiB or more is
+ * not saved.
+ * @param h The hash table, which must not itself have been loaded.
+ * @param path The name of the file to write.
+ * @return 1 if the snapshot was written, 0 otherwise.
+ */
+int htable_save(htable h, const char *path){
+    struct htable_header header;
+    unsigned int *slot;
+    unsigned int offset = 0;
+    size_t bytes = 0;
+    FILE *out;
+    int ok;
+    int i;
+
+    if(h->image != NULL) return 0;
+    htable_rehash_finish(h);
+    for(i = 0; i < h->capacity; i++){
+        if(HTABLE_HAS_KEY(h->keys[i])) bytes += strlen(h->keys[i]) + 1;
+    }
+    if(bytes > UINT_MAX) return 0;
+    /* a tombstone would be saved as an empty slot, cutting probe chains */
+    if(h->num_tombstones > 0){
+        htable_resize(h, h->capacity);
+        htable_rehash_finish(h);
+    }
+    if(NULL == (out = fopen(path, "wb"))) return 0;
+    slot = emalloc(h->capacity * sizeof slot[0]);
+    memcpy(header.magic, HTABLE_MAGIC, sizeof header.magic);
+    header.method = h->method;
+    header.sizing = h->sizing;
+    header.hash_fn = h->hash_fn;
+    header.capacity = h->capacity;
+    header.num_keys = h->num_keys;
+    header.key_bytes = bytes;
+    ok = fwrite(&header, sizeof header, 1, out) == 1;
 
-       
-        
+    for(i = 0; i < h->capacity; i++){
+        slot[i] = h->keys[i] != NULL ? h->hashes[i] : 0;
+    }
+    ok = ok && fwrite(slot, sizeof slot[0], h->capacity, out)
+               == (size_t) h->capacity;
+    ok = ok && fwrite(h->freqs, sizeof h->freqs[0], h->capacity, out)
+               == (size_t) h->capacity;
+    for(offset = 0, i = 0; i < h->capacity; i++){
+        slot[i] = h->keys[i] != NULL ? offset + 1 : 0;
+        if(h->keys[i] != NULL) offset += strlen(h->keys[i]) + 1;
+    }
+    ok = ok && fwrite(slot, sizeof slot[0], h->capacity, out)
+               == (size_t) h->capacity;
+    for(i = 0; ok && i < h->capacity; i++){
+        if(h->keys[i] != NULL){
+            ok = fwrite(h->keys[i], strlen(h->keys[i]) + 1, 1, out) == 1;
+        }
+    }
+
+    free(slot);
+    return fclose(out) == 0 && ok;
+}
 
+/**
+ * Maps a snapshot written by htable_save into memory as a hash table.
+ * Nothing is read or allocated per key; searches read the slots and
+ * keys straight out of the mapping, so only the pages they touch are
+ * ever brought in.  The table can be searched, printed and freed, but
+ * not changed.  Only the key offsets are checked, so that every key
+ * lies inside the file and ends with a '\0'.
+ * @param path The name of the snapshot file.
+ * @return the hash table, or NULL if the file could not be mapped or
+ *         is not a snapshot.
+ */
+htable htable_load(const char *path){
+    struct htable_header *header;
+    unsigned int *offsets;
+    size_t len;
+    size_t slots;
+    size_t i;
+    char *image = map_file(path, &len);
+    htable h;
 
+    if(NULL == image) return NULL;
+    header = (struct htable_header *) image;
+    slots = len < sizeof *header ? 0 : header->capacity;
+    if(len < sizeof *header
+       || memcmp(header->magic, HTABLE_MAGIC, sizeof header->magic) != 0
+       || header->method > GROUP_P || header->sizing > POW2_SIZE
+       || header->hash_fn > MURMUR_3 || slots == 0
+       || slots > HTABLE_MAX_CAPACITY
+       /* the double hashing step divides by one less than the capacity */
+       || (header->method == DOUBLE_H && slots == 1)
+       || (len - sizeof *header) / (3 * sizeof(unsigned int)) < slots
+       || len - sizeof *header - 3 * sizeof(unsigned int) * slots
+          != header->key_bytes
+       || (header->key_bytes > 0 && image[len - 1] != '\0')){
+        unmap_file(image, len);
+        return NULL;
+    }
+    offsets = (unsigned int *) (image + sizeof *header) + 2 * slots;
+    for(i = 0; i < slots; i++){
+        if(offsets[i] > header->key_bytes){
+            unmap_file(image, len);
+            return NULL;
+        }
+    }
 
-    
-    
+    h = htable_new(1, header->method, header->sizing, header->hash_fn);
+    free(h->freqs);
+    free(h->keys);
+    free(h->hashes);
+    free(h->ctrl);
+    free(h->stats);
+    arena_free(h->strings);
+    h->strings = NULL;
+    h->keys = NULL;
+    h->ctrl = NULL;
+    h->stats = NULL;
 
+    h->image = image;
+    h->image_len = len;
+    h->capacity = header->capacity;
+    h->num_keys = header->num_keys;
+    h->hashes = (unsigned int *) (image + sizeof *header);
+    h->freqs = (int *) (h->hashes + slots);
+    h->offsets = (unsigned int *) (h->freqs + slots);
+    h->image_keys = (char *) (h->offsets + slots);
+    return h;
+}
@@ -4,15 +4,30 @@
 #include <stdio.h>
 
 typedef struct htablerec *htable;
-typedef enum hashing_e {LINEAR_P, DOUBLE_H} hashing_t;
+typedef enum hashing_e {LINEAR_P, DOUBLE_H, ROBIN_HOOD, GROUP_P} hashing_t;
+typedef enum sizing_e {PRIME_SIZE, POW2_SIZE} sizing_t;
+typedef enum hashfn_e {WORD_31, FNV_1A, MURMUR_3} hashfn_t;
 
 extern void htable_free(htable h);
-extern htable htable_new(int capacity, hashing_t t);
+extern htable htable_new(int capacity, hashing_t t, sizing_t s,
+                         hashfn_t f);
+extern void htable_set_max_load(htable h, double load);
+extern int htable_size(htable h);
 extern void htable_print(htable h, void f(int freq, char *s));
+extern int htable_top(htable h, int k, char **words, int *freqs);
 extern int htable_insert(htable h, char *s);
+extern int htable_delete(htable h, char *s);
+extern int htable_decrement(htable h, char *s);
+extern void htable_share(htable h, int threads);
+extern int htable_insert_shared(htable h, int thread, char *s);
+extern int htable_search_shared(htable h, char *s);
+extern void htable_merge(htable h, htable from);
 extern int htable_search(htable h, char *s);
+extern void htable_search_batch(htable h, char **words, int n, int *out);
 extern void htable_print_stats(htable h, FILE *stream, int num_stats);
 extern void htable_print_entire_htable(htable h);
+extern int htable_save(htable h, const char *path);
+extern htable htable_load(const char *path);
 
 
 #endif
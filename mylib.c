@@ -1,9 +1,61 @@
+/* mmap and friends are POSIX rather than ANSI C */
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <assert.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mylib.h"
 
+/* Default number of bytes in each arena chunk. */
+#define ARENA_CHUNK 65536
+
+/* Bytes a writer collects before each write. */
+#define WRITER_BUFFER 65536
+
+/* Runs this short are sorted by insertion rather than by radix. */
+#define RADIX_CUTOFF 32
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+};
+
+struct arenarec {
+    struct arena_chunk *head;
+};
+
+struct writerrec {
+    int fd;
+    size_t used;
+    char buf[WRITER_BUFFER];
+};
+
+/* Number of bytes read from the stream at a time by a tokenizer. */
+#define TOKENIZER_BUFFER 65536
+
+/* Byte classes in a tokenizer table, word bytes map to themselves. */
+#define TOKEN_SEPARATOR 0
+#define TOKEN_SKIP 1
+
+struct tokenizerrec {
+    /* NULL when the words come from a caller's buffer */
+    FILE *stream;
+    int limit;
+    size_t pos;
+    size_t len;
+    /* byte overwritten by the terminator of the last word, if any */
+    int saved;
+    unsigned char table[256];
+    unsigned char *buf;
+};
+
 void *emalloc(size_t s){
   void *p = malloc(s);
   if(NULL == p){
@@ -48,20 +100,25 @@ int getword(char *s, int limit, FILE *stream){
 }
 
 
-/** support function for get_prime */
+/** support function for get_prime, trial division by 2, 3 and then
+    6k +/- 1 up to the square root of n */
 static int is_prime(int n){
-    int i, j=0;
-    for(i=1; i<=n; i++){
-        if(n%i == 0){
-            j++;
-        }
+    int i;
+    if(n < 2){
+        return 0;
     }
-    if(j == 2){
+    if(n < 4){
         return 1;
-    } else if(j > 2){
+    }
+    if(n % 2 == 0 || n % 3 == 0){
         return 0;
     }
-    return 0;
+    for(i = 5; i <= n / i; i += 6){
+        if(n % i == 0 || n % (i + 2) == 0){
+            return 0;
+        }
+    }
+    return 1;
 }
 
 /**
@@ -84,3 +141,545 @@ int get_prime(unsigned int n){
     
  
   
+
+
+/**
+   checks whether one word ranks below another in a top-k list, having a
+   lower frequency, or the same frequency and a later spelling
+   @param f1, the frequency of the first word
+   @param w1, the first word
+   @param f2, the frequency of the second word
+   @param w2, the second word
+   @return nonzero if the first word ranks below the second
+**/
+static int topk_below(int f1, char *w1, int f2, char *w2){
+    if(f1 != f2) return f1 < f2;
+    return strcmp(w1, w2) > 0;
+}
+
+/**
+   moves the word at position i down a min-heap of words until neither
+   of its children ranks below it
+   @param words, the words in the heap
+   @param freqs, the frequency of each word
+   @param n, the number of words in the heap
+   @param i, the position of the word to move
+**/
+static void topk_sift(char **words, int *freqs, int n, int i){
+    char *w = words[i];
+    int f = freqs[i];
+    int child;
+
+    while((child = 2 * i + 1) < n){
+        if(child + 1 < n && topk_below(freqs[child + 1], words[child + 1],
+                                       freqs[child], words[child])){
+            child++;
+        }
+        if(!topk_below(freqs[child], words[child], f, w)) break;
+        words[i] = words[child];
+        freqs[i] = freqs[child];
+        i = child;
+    }
+    words[i] = w;
+    freqs[i] = f;
+}
+
+/**
+   offers a word to a list of the k most frequent words seen so far,
+   kept as a min-heap with the lowest ranked word first, so each offer
+   takes O(log k)
+   @param words, the words in the list, room for k of them
+   @param freqs, the frequency of each word, room for k of them
+   @param n, the number of words in the list
+   @param k, the largest number of words the list holds
+   @param word, the word offered
+   @param freq, the frequency of the word offered
+   @return the new number of words in the list
+**/
+int topk_add(char **words, int *freqs, int n, int k, char *word, int freq){
+    int i;
+
+    if(n < k){
+        /* move the new word up until its parent ranks below it */
+        for(i = n; i > 0 && topk_below(freq, word, freqs[(i - 1) / 2],
+                                       words[(i - 1) / 2]); i = (i - 1) / 2){
+            words[i] = words[(i - 1) / 2];
+            freqs[i] = freqs[(i - 1) / 2];
+        }
+        words[i] = word;
+        freqs[i] = freq;
+        return n + 1;
+    }
+    if(k > 0 && topk_below(freqs[0], words[0], freq, word)){
+        words[0] = word;
+        freqs[0] = freq;
+        topk_sift(words, freqs, n, 0);
+    }
+    return n;
+}
+
+/**
+   sorts a list built by topk_add into order, most frequent first, by
+   moving the lowest ranked word to the end until none are left
+   @param words, the words in the list
+   @param freqs, the frequency of each word
+   @param n, the number of words in the list
+**/
+void topk_sort(char **words, int *freqs, int n){
+    char *w;
+    int f;
+
+    while(--n > 0){
+        w = words[0];
+        f = freqs[0];
+        words[0] = words[n];
+        freqs[0] = freqs[n];
+        words[n] = w;
+        freqs[n] = f;
+        topk_sift(words, freqs, n, 0);
+    }
+}
+
+/**
+   creates a new, empty arena for strings
+   @return the new arena
+**/
+arena arena_new(void){
+    arena a = emalloc(sizeof *a);
+    a->head = NULL;
+    return a;
+}
+
+/**
+   copies a string into an arena, starting a new chunk when the current
+   one is too full.  The copy lives until the arena is freed.
+   @param a, the arena to copy into
+   @param s, the string to copy
+   @return the copy of s
+**/
+char *arena_strdup(arena a, const char *s){
+    size_t len = strlen(s) + 1;
+    size_t size = len > ARENA_CHUNK ? len : ARENA_CHUNK;
+    struct arena_chunk *c = a->head;
+    char *p;
+
+    if(NULL == c || c->size - c->used < len){
+        c = emalloc(sizeof *c + size);
+        c->next = a->head;
+        c->size = size;
+        c->used = 0;
+        a->head = c;
+    }
+    p = (char *) (c + 1) + c->used;
+    c->used += len;
+    memcpy(p, s, len);
+    return p;
+}
+
+/**
+   frees an arena and every string copied into it
+   @param a, the arena to free
+**/
+void arena_free(arena a){
+    struct arena_chunk *c;
+
+    while(NULL != (c = a->head)){
+        a->head = c->next;
+        free(c);
+    }
+    free(a);
+}
+
+
+/**
+   creates a tokenizer with an empty buffer and its byte table filled in
+   @param limit, one more than the most characters returned per word
+   @return the new tokenizer
+**/
+static tokenizer tokenizer_init(int limit){
+    tokenizer t = emalloc(sizeof *t);
+    int c;
+
+    t->stream = NULL;
+    t->limit = limit;
+    t->pos = 0;
+    t->len = 0;
+    t->saved = EOF;
+    t->buf = NULL;
+    for(c = 0; c < 256; c++){
+        if(isalnum(c)){
+            t->table[c] = tolower(c);
+        } else if('\'' == c){
+            t->table[c] = TOKEN_SKIP;
+        } else {
+            t->table[c] = TOKEN_SEPARATOR;
+        }
+    }
+    return t;
+}
+
+/**
+   creates a tokenizer that splits a stream into words the same way as
+   getword, reading the stream a large block at a time
+   @param stream, the stream to read words from
+   @param limit, one more than the most characters returned per word
+   @return the new tokenizer
+**/
+tokenizer tokenizer_new(FILE *stream, int limit){
+    tokenizer t;
+
+    assert(limit > 1 && limit <= TOKENIZER_BUFFER && stream != NULL);
+    t = tokenizer_init(limit);
+    t->stream = stream;
+    t->buf = emalloc(TOKENIZER_BUFFER + 1);
+    return t;
+}
+
+/**
+   creates a tokenizer that splits text already in memory into words
+   the same way as getword.  Words are rewritten in place, so s must be
+   writable and have one spare byte after its last character.
+   @param s, the text to split
+   @param len, the number of characters in s
+   @param limit, one more than the most characters returned per word
+   @return the new tokenizer
+**/
+tokenizer tokenizer_new_buffer(char *s, size_t len, int limit){
+    tokenizer t;
+
+    assert(limit > 1 && s != NULL);
+    t = tokenizer_init(limit);
+    t->buf = (unsigned char *) s;
+    t->len = len;
+    return t;
+}
+
+/**
+   reads more of the stream into a tokenizer's buffer, keeping the
+   bytes from start onwards at the front of the buffer
+   @param t, the tokenizer
+   @param start, the first byte that is still needed
+   @return the number of new bytes read
+**/
+static size_t tokenizer_fill(tokenizer t, size_t start){
+    size_t n;
+
+    if(NULL == t->stream) return 0;
+    memmove(t->buf, t->buf + start, t->len - start);
+    t->len -= start;
+    t->pos -= start;
+    n = fread(t->buf + t->len, 1, TOKENIZER_BUFFER - t->len, t->stream);
+    t->len += n;
+    return n;
+}
+
+/**
+   finds the next word in a tokenizer's stream.  Words are lower-cased
+   and have apostrophes removed in place, so the word points into the
+   tokenizer's buffer and is only valid until the next call.
+   @param t, the tokenizer
+   @param word, set to the start of the next word
+   @return the length of the word, or EOF at the end of the stream
+**/
+int tokenizer_next(tokenizer t, char **word){
+    unsigned char *table = t->table;
+    size_t start;
+    size_t w;
+    int n = 0;
+    unsigned char c;
+
+    if(EOF != t->saved){
+        t->buf[t->pos] = t->saved;
+        t->saved = EOF;
+    }
+    for(;;){
+        while(t->pos < t->len && table[t->buf[t->pos]] <= TOKEN_SKIP){
+            t->pos++;
+        }
+        if(t->pos < t->len) break;
+        if(0 == tokenizer_fill(t, t->pos)) return EOF;
+    }
+
+    start = w = t->pos;
+    while(n < t->limit - 1){
+        if(t->pos == t->len){
+            if(NULL == t->stream) break;
+            /* only the compacted word is kept when refilling */
+            t->len = w;
+            t->pos = w;
+            c = 0 < tokenizer_fill(t, start);
+            w -= start;
+            start = 0;
+            if(!c) break;
+        }
+        c = table[t->buf[t->pos]];
+        if(TOKEN_SEPARATOR == c){
+            t->pos++;
+            break;
+        }
+        t->pos++;
+        if(TOKEN_SKIP != c){
+            t->buf[w++] = c;
+            n++;
+        }
+    }
+
+    if(w == t->pos && w < t->len){
+        t->saved = t->buf[w];
+    }
+    t->buf[w] = '\0';
+    *word = (char *) t->buf + start;
+    return n;
+}
+
+/**
+   frees a tokenizer, leaving its stream open
+   @param t, the tokenizer to free
+**/
+void tokenizer_free(tokenizer t){
+    if(NULL != t->stream) free(t->buf);
+    free(t);
+}
+
+/**
+   maps a whole file into memory read only, so its pages are only read
+   from disk, or shared from the page cache, as they are touched
+   @param path, the name of the file to map
+   @param len, set to the length of the file
+   @return the start of the mapping, or NULL if the file could not be
+   opened or mapped, or is empty
+**/
+void *map_file(const char *path, size_t *len){
+    struct stat st;
+    void *p;
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0) return NULL;
+    if(fstat(fd, &st) != 0 || st.st_size == 0){
+        close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(MAP_FAILED == p) return NULL;
+    *len = st.st_size;
+    return p;
+}
+
+/**
+   unmaps a file mapped by map_file
+   @param p, the start of the mapping
+   @param len, the length of the file
+**/
+void unmap_file(void *p, size_t len){
+    munmap(p, len);
+}
+
+/**
+   creates a writer, which collects output in a large buffer and hands
+   it to the operating system with one write call each time it fills.
+   Anything stdio has buffered for the same file should be flushed first
+   @param fd, the file descriptor to write to
+   @return the new writer
+**/
+writer writer_new(int fd){
+    writer w = emalloc(sizeof *w);
+    w->fd = fd;
+    w->used = 0;
+    return w;
+}
+
+/**
+   writes out everything a writer has collected
+   @param w, the writer
+**/
+void writer_flush(writer w){
+    size_t done = 0;
+    ssize_t n;
+
+    while(done < w->used){
+        n = write(w->fd, w->buf + done, w->used - done);
+        if(n < 0){
+            fprintf(stderr, "Write failed!\n");
+            exit(EXIT_FAILURE);
+        }
+        done += n;
+    }
+    w->used = 0;
+}
+
+/**
+   adds a string to a writer's output
+   @param w, the writer
+   @param s, the string
+**/
+void writer_str(writer w, const char *s){
+    size_t len = strlen(s);
+    size_t n;
+
+    while(len > 0){
+        if(w->used == WRITER_BUFFER) writer_flush(w);
+        n = WRITER_BUFFER - w->used < len ? WRITER_BUFFER - w->used : len;
+        memcpy(w->buf + w->used, s, n);
+        w->used += n;
+        s += n;
+        len -= n;
+    }
+}
+
+/**
+   adds a character to a writer's output
+   @param w, the writer
+   @param c, the character
+**/
+void writer_char(writer w, char c){
+    if(w->used == WRITER_BUFFER) writer_flush(w);
+    w->buf[w->used++] = c;
+}
+
+/**
+   adds a number to a writer's output in decimal, padded with spaces to
+   a width in the same way as printf's %5d and %-4d
+   @param w, the writer
+   @param n, the number
+   @param width, the smallest number of characters to write, padding on
+   the left if positive and on the right if negative
+**/
+void writer_int(writer w, int n, int width){
+    char digits[16];
+    unsigned int u = n < 0 ? 0u - (unsigned int) n : (unsigned int) n;
+    int len = 0;
+    int pad;
+
+    do {
+        digits[sizeof digits - ++len] = '0' + u % 10;
+        u /= 10;
+    } while(u != 0);
+    if(n < 0) digits[sizeof digits - ++len] = '-';
+
+    pad = (width < 0 ? -width : width) - len;
+    if(w->used + len + (pad > 0 ? pad : 0) > WRITER_BUFFER) writer_flush(w);
+    for(; width > 0 && pad > 0; pad--) w->buf[w->used++] = ' ';
+    memcpy(w->buf + w->used, digits + sizeof digits - len, len);
+    w->used += len;
+    for(; pad > 0; pad--) w->buf[w->used++] = ' ';
+}
+
+/**
+   flushes and frees a writer, leaving its file open
+   @param w, the writer
+**/
+void writer_free(writer w){
+    writer_flush(w);
+    free(w);
+}
+
+/**
+   sorts words into descending order of frequency with a stable least
+   significant digit radix sort, a byte of the frequency at a time, so
+   words of equal frequency keep their order
+   @param words, the words
+   @param freqs, the frequency of each word
+   @param n, the number of words
+**/
+void radix_sort_freqs(char **words, int *freqs, int n){
+    char **tw = emalloc((n + 1) * sizeof tw[0]);
+    int *tf = emalloc((n + 1) * sizeof tf[0]);
+    int count[257];
+    unsigned int all_or = 0;
+    unsigned int all_and = ~0u;
+    unsigned int digit;
+    int shift;
+    int i;
+
+    for(i = 0; i < n; i++){
+        all_or |= freqs[i];
+        all_and &= freqs[i];
+    }
+    for(shift = 0; shift < 32; shift += 8){
+        /* a byte that is the same in every frequency changes nothing */
+        if((((all_or ^ all_and) >> shift) & 0xff) == 0) continue;
+        for(i = 0; i < 257; i++) count[i] = 0;
+        /* counting 255 - digit puts larger frequencies first */
+        for(i = 0; i < n; i++){
+            digit = 255 - (((unsigned int) freqs[i] >> shift) & 0xff);
+            count[digit + 1]++;
+        }
+        for(i = 0; i < 256; i++) count[i + 1] += count[i];
+        for(i = 0; i < n; i++){
+            digit = 255 - (((unsigned int) freqs[i] >> shift) & 0xff);
+            tw[count[digit]] = words[i];
+            tf[count[digit]++] = freqs[i];
+        }
+        memcpy(words, tw, n * sizeof words[0]);
+        memcpy(freqs, tf, n * sizeof freqs[0]);
+    }
+    free(tw);
+    free(tf);
+}
+
+/**
+   sorts part of a list of words by most significant digit radix sort,
+   knowing that they all share their first d bytes
+   @param words, the words
+   @param freqs, the frequency of each word, moved with it
+   @param tw, scratch space for n words
+   @param tf, scratch space for n frequencies
+   @param n, the number of words
+   @param d, the number of leading bytes the words share
+**/
+static void radix_words(char **words, int *freqs, char **tw, int *tf, int n,
+                        int d){
+    int count[257];
+    int start[256];
+    char *w;
+    int f;
+    int i, j;
+
+    if(n < RADIX_CUTOFF){
+        for(i = 1; i < n; i++){
+            w = words[i];
+            f = freqs[i];
+            for(j = i; j > 0 && strcmp(words[j - 1] + d, w + d) > 0; j--){
+                words[j] = words[j - 1];
+                freqs[j] = freqs[j - 1];
+            }
+            words[j] = w;
+            freqs[j] = f;
+        }
+        return;
+    }
+    for(i = 0; i < 257; i++) count[i] = 0;
+    for(i = 0; i < n; i++) count[(unsigned char) words[i][d] + 1]++;
+    for(i = 0; i < 256; i++) count[i + 1] += count[i];
+    for(i = 0; i < 256; i++) start[i] = count[i];
+    for(i = 0; i < n; i++){
+        j = count[(unsigned char) words[i][d]]++;
+        tw[j] = words[i];
+        tf[j] = freqs[i];
+    }
+    memcpy(words, tw, n * sizeof words[0]);
+    memcpy(freqs, tf, n * sizeof freqs[0]);
+    /* words that end here are equal, the rest share one more byte */
+    for(i = 1; i < 256; i++){
+        if(count[i] - start[i] > 1){
+            radix_words(words + start[i], freqs + start[i], tw, tf,
+                        count[i] - start[i], d + 1);
+        }
+    }
+}
+
+/**
+   sorts words into the order strcmp gives, by radix sort
+   @param words, the words
+   @param freqs, the frequency of each word, moved with it
+   @param n, the number of words
+**/
+void radix_sort_words(char **words, int *freqs, int n){
+    char **tw = emalloc((n + 1) * sizeof tw[0]);
+    int *tf = emalloc((n + 1) * sizeof tf[0]);
+
+    radix_words(words, freqs, tw, tf, n, 0);
+    free(tw);
+    free(tf);
+}
@@ -3,10 +3,34 @@
 
 #include <stddef.h>
 
+typedef struct arenarec *arena;
+typedef struct tokenizerrec *tokenizer;
+typedef struct writerrec *writer;
+
 extern void *emalloc(size_t);
 extern void *erealloc(void*, size_t);
 extern int getword(char *s, int limit, FILE *stream);
 extern int get_prime(unsigned int n);
+extern arena arena_new(void);
+extern char *arena_strdup(arena a, const char *s);
+extern void arena_free(arena a);
+extern tokenizer tokenizer_new(FILE *stream, int limit);
+extern tokenizer tokenizer_new_buffer(char *s, size_t len, int limit);
+extern int tokenizer_next(tokenizer t, char **word);
+extern void tokenizer_free(tokenizer t);
+extern int topk_add(char **words, int *freqs, int n, int k, char *word,
+                    int freq);
+extern void topk_sort(char **words, int *freqs, int n);
+extern void *map_file(const char *path, size_t *len);
+extern void unmap_file(void *p, size_t len);
+extern writer writer_new(int fd);
+extern void writer_str(writer w, const char *s);
+extern void writer_char(writer w, char c);
+extern void writer_int(writer w, int n, int width);
+extern void writer_flush(writer w);
+extern void writer_free(writer w);
+extern void radix_sort_freqs(char **words, int *freqs, int n);
+extern void radix_sort_words(char **words, int *freqs, int n);
 
 #endif
 
@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mylib.h"
+#include "suggest.h"
+
+/* Largest edit distance of a suggestion. */
+#define SUGGEST_DISTANCE 2
+
+/* Only this many leading characters of a word are indexed. */
+#define SUGGEST_PREFIX 7
+
+/* Initial capacity of the deletion index, a power of two. */
+#define SUGGEST_CAPACITY 1024
+
+/* The best suggestions found so far by suggest_lookup, in order. */
+struct suggest_best {
+    char *word;
+    int *dist;
+    int *index;
+    int k;
+    int n;
+};
+
+/*
+ * Spelling suggestions found by the symmetric delete method.  Every
+ * string made by deleting up to SUGGEST_DISTANCE characters from the
+ * prefix of a dictionary word is indexed, pointing back at the word.
+ * A misspelling within that distance of a word shares at least one
+ * such deletion with it, so a lookup only generates the deletions of
+ * the misspelling and checks the words they lead to.
+ */
+struct suggestrec {
+    /* the dictionary, with each word's frequency */
+    char **words;
+    int *freqs;
+    int num_words;
+    int words_size;
+    /* deletions, by open addressing, each heading a list of postings */
+    char **keys;
+    unsigned int *hashes;
+    int *heads;
+    int capacity;
+    int num_keys;
+    /* postings, each a word and the next posting of the same deletion */
+    int *post_word;
+    int *post_next;
+    int num_posts;
+    int posts_size;
+    /* the words, and deletions, live here */
+    arena strings;
+    /* lookup number last to see each word, so each is checked once */
+    int *seen;
+    int stamp;
+    /* rows of the edit distance table */
+    int *rows;
+    int row_len;
+    /* the best suggestions of the lookup in progress, with room for
+       best_size of them kept from one lookup to the next */
+    struct suggest_best best;
+    int best_size;
+};
+
+/**
+ * Hashes a string with 32-bit FNV-1a.
+ * @param str the string.
+ * @param len the number of characters to hash.
+ * @return the hash.
+ */
+static unsigned int suggest_hash(const char *str, int len){
+    unsigned int h = 2166136261u;
+    int i;
+
+    for(i = 0; i < len; i++){
+        h = ((h ^ (unsigned char) str[i]) * 16777619u) & 0xffffffffu;
+    }
+    return h;
+}
+
+/**
+ * Finds the slot of a deletion in the index.
+ * @param s the suggester.
+ * @param key the deletion, which need not end in '\0'.
+ * @param len the length of the deletion.
+ * @param hash the hash of the deletion.
+ * @return the slot holding the deletion, or the empty slot where it
+ *         would go.
+ */
+static int suggest_slot(suggest s, const char *key, int len,
+                        unsigned int hash){
+    unsigned int i = hash & (s->capacity - 1);
+
+    while(s->keys[i] != NULL){
+        if(s->hashes[i] == hash && strncmp(s->keys[i], key, len) == 0
+           && s->keys[i][len] == '\0'){
+            return i;
+        }
+        i = (i + 1) & (s->capacity - 1);
+    }
+    return i;
+}
+
+/**
+ * Doubles the capacity of the deletion index.
+ * @param s the suggester.
+ */
+static void suggest_grow(suggest s){
+    char **keys = s->keys;
+    unsigned int *hashes = s->hashes;
+    int *heads = s->heads;
+    int capacity = s->capacity;
+    int i, j;
+
+    s->capacity *= 2;
+    s->keys = emalloc(s->capacity * sizeof s->keys[0]);
+    s->hashes = emalloc(s->capacity * sizeof s->hashes[0]);
+    s->heads = emalloc(s->capacity * sizeof s->heads[0]);
+    for(i = 0; i < s->capacity; i++) s->keys[i] = NULL;
+    for(i = 0; i < capacity; i++){
+        if(keys[i] == NULL) continue;
+        j = hashes[i] & (s->capacity - 1);
+        while(s->keys[j] != NULL) j = (j + 1) & (s->capacity - 1);
+        s->keys[j] = keys[i];
+        s->hashes[j] = hashes[i];
+        s->heads[j] = heads[i];
+    }
+    free(keys);
+    free(hashes);
+    free(heads);
+}
+
+/**
+ * Indexes one deletion of a word.  A word can reach the same deletion
+ * in more than one way, so a posting is only added if the deletion's
+ * newest posting is not already for this word.
+ * @param s the suggester.
+ * @param key the deletion.
+ * @param len the length of the deletion.
+ * @param word the index of the word it came from.
+ */
+static void suggest_post(suggest s, char *key, int len, int word){
+    unsigned int hash = suggest_hash(key, len);
+    int i = suggest_slot(s, key, len, hash);
+    char c;
+
+    if(s->keys[i] == NULL){
+        if(2 * (s->num_keys + 1) > s->capacity){
+            suggest_grow(s);
+            i = suggest_slot(s, key, len, hash);
+        }
+        c = key[len];
+        key[len] = '\0';
+        s->keys[i] = arena_strdup(s->strings, key);
+        key[len] = c;
+        s->hashes[i] = hash;
+        s->heads[i] = -1;
+        s->num_keys++;
+    } else if(s->post_word[s->heads[i]] == word){
+        return;
+    }
+    if(s->num_posts == s->posts_size){
+        s->posts_size *= 2;
+        s->post_word = erealloc(s->post_word,
+                                s->posts_size * sizeof s->post_word[0]);
+        s->post_next = erealloc(s->post_next,
+                                s->posts_size * sizeof s->post_next[0]);
+    }
+    s->post_word[s->num_posts] = word;
+    s->post_next[s->num_posts] = s->heads[i];
+    s->heads[i] = s->num_posts++;
+}
+
+/**
+ * Calls a function on every string made by deleting up to depth more
+ * characters from a string, the string itself included.  A string can
+ * be reached more than once.
+ * @param str the string, which need not end in '\0'.
+ * @param len the length of the string.
+ * @param depth the number of characters that may still be deleted.
+ * @param from deletions start at this position, so each set of
+ *        positions is only tried in one order.
+ * @param f the function to call with each string and its length.
+ * @param s the suggester, passed on to f.
+ * @param arg passed on to f.
+ */
+static void suggest_deletes(char *str, int len, int depth, int from,
+                            void f(suggest s, char *str, int len, int arg),
+                            suggest s, int arg){
+    char buf[SUGGEST_PREFIX + 1];
+    int i;
+
+    f(s, str, len, arg);
+    if(depth == 0 || len == 0) return;
+    for(i = from; i < len; i++){
+        memcpy(buf, str, i);
+        memcpy(buf + i, str + i + 1, len - i - 1);
+        suggest_deletes(buf, len - 1, depth - 1, i, f, s, arg);
+    }
+}
+
+/**
+ * Creates a suggester with an empty dictionary.
+ * @return the new suggester.
+ */
+suggest suggest_new(void){
+    suggest s = emalloc(sizeof *s);
+    int i;
+
+    s->words_size = 1024;
+    s->words = emalloc(s->words_size * sizeof s->words[0]);
+    s->freqs = emalloc(s->words_size * sizeof s->freqs[0]);
+    s->seen = emalloc(s->words_size * sizeof s->seen[0]);
+    s->num_words = 0;
+    s->capacity = SUGGEST_CAPACITY;
+    s->keys = emalloc(s->capacity * sizeof s->keys[0]);
+    s->hashes = emalloc(s->capacity * sizeof s->hashes[0]);
+    s->heads = emalloc(s->capacity * sizeof s->heads[0]);
+    for(i = 0; i < s->capacity; i++) s->keys[i] = NULL;
+    s->num_keys = 0;
+    s->posts_size = 4096;
+    s->post_word = emalloc(s->posts_size * sizeof s->post_word[0]);
+    s->post_next = emalloc(s->posts_size * sizeof s->post_next[0]);
+    s->num_posts = 0;
+    s->strings = arena_new();
+    s->stamp = 0;
+    s->row_len = 0;
+    s->rows = NULL;
+    s->best.dist = NULL;
+    s->best.index = NULL;
+    s->best_size = 0;
+    return s;
+}
+
+/**
+ * Adds a word of the dictionary, which must not already have been
+ * added, and indexes its deletions.
+ * @param s the suggester.
+ * @param word the word.
+ * @param freq how often the word occurs, more common words being
+ *        suggested first.
+ */
+void suggest_add(suggest s, char *word, int freq){
+    char prefix[SUGGEST_PREFIX + 1];
+    int len = strlen(word);
+
+    if(s->num_words == s->words_size){
+        s->words_size *= 2;
+        s->words = erealloc(s->words, s->words_size * sizeof s->words[0]);
+        s->freqs = erealloc(s->freqs, s->words_size * sizeof s->freqs[0]);
+        s->seen = erealloc(s->seen, s->words_size * sizeof s->seen[0]);
+    }
+    s->words[s->num_words] = arena_strdup(s->strings, word);
+    s->freqs[s->num_words] = freq;
+    s->seen[s->num_words] = 0;
+    if(len > SUGGEST_PREFIX) len = SUGGEST_PREFIX;
+    memcpy(prefix, word, len);
+    prefix[len] = '\0';
+    suggest_deletes(prefix, len, SUGGEST_DISTANCE, 0, suggest_post, s,
+                    s->num_words);
+    s->num_words++;
+}
+
+/**
+ * Works out the optimal string alignment distance between two strings,
+ * counting insertions, deletions, substitutions and swaps of adjacent
+ * characters, giving up once it must be more than SUGGEST_DISTANCE.
+ * @param s the suggester, whose rows are used for the table.
+ * @param a the first string.
+ * @param b the second string.
+ * @return the distance, or SUGGEST_DISTANCE + 1 if it is larger.
+ */
+static int suggest_distance(suggest s, const char *a, const char *b){
+    int la = strlen(a);
+    int lb = strlen(b);
+    int *prev2, *prev, *cur, *tmp;
+    int best;
+    int cost;
+    int i, j;
+
+    if(la - lb > SUGGEST_DISTANCE || lb - la > SUGGEST_DISTANCE){
+        return SUGGEST_DISTANCE + 1;
+    }
+    if(s->row_len < lb + 1){
+        s->row_len = 2 * (lb + 1);
+        s->rows = erealloc(s->rows, 3 * s->row_len * sizeof s->rows[0]);
+    }
+    prev2 = s->rows;
+    prev = prev2 + s->row_len;
+    cur = prev + s->row_len;
+    for(j = 0; j <= lb; j++) prev[j] = j;
+    for(i = 1; i <= la; i++){
+        cur[0] = best = i;
+        for(j = 1; j <= lb; j++){
+            cost = a[i - 1] != b[j - 1];
+            cur[j] = prev[j - 1] + cost;
+            if(prev[j] + 1 < cur[j]) cur[j] = prev[j] + 1;
+            if(cur[j - 1] + 1 < cur[j]) cur[j] = cur[j - 1] + 1;
+            if(i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]
+               && prev2[j - 2] + 1 < cur[j]){
+                cur[j] = prev2[j - 2] + 1;
+            }
+            if(cur[j] < best) best = cur[j];
+        }
+        /* every later row is at least the smallest value in this one */
+        if(best > SUGGEST_DISTANCE) return SUGGEST_DISTANCE + 1;
+        tmp = prev2;
+        prev2 = prev;
+        prev = cur;
+        cur = tmp;
+    }
+    return prev[lb];
+}
+
+/**
+ * Checks whether one candidate should come before another: a smaller
+ * distance first, then a more common word, then alphabetical order.
+ * @param s the suggester.
+ * @param d1 the distance of the first candidate.
+ * @param w1 the index of the first candidate.
+ * @param d2 the distance of the second candidate.
+ * @param w2 the index of the second candidate.
+ * @return nonzero if the first candidate comes first.
+ */
+static int suggest_before(suggest s, int d1, int w1, int d2, int w2){
+    if(d1 != d2) return d1 < d2;
+    if(s->freqs[w1] != s->freqs[w2]) return s->freqs[w1] > s->freqs[w2];
+    return strcmp(s->words[w1], s->words[w2]) < 0;
+}
+
+/**
+ * Checks each word that has a deletion in common with the word being
+ * looked up, keeping the best k in order by insertion.
+ * @param s the suggester.
+ * @param key a deletion of the word being looked up.
+ * @param len the length of the deletion.
+ * @param unused not used.
+ */
+static void suggest_candidates(suggest s, char *key, int len, int unused){
+    struct suggest_best *best = &s->best;
+    unsigned int hash = suggest_hash(key, len);
+    int i = suggest_slot(s, key, len, hash);
+    int post;
+    int word;
+    int d;
+    int j;
+
+    (void) unused;
+    if(s->keys[i] == NULL) return;
+    for(post = s->heads[i]; post >= 0; post = s->post_next[post]){
+        word = s->post_word[post];
+        if(s->seen[word] == s->stamp) continue;
+        s->seen[word] = s->stamp;
+        d = suggest_distance(s, best->word, s->words[word]);
+        if(d > SUGGEST_DISTANCE) continue;
+        if(best->n == best->k && !suggest_before(s, d, word,
+                                                 best->dist[best->k - 1],
+                                                 best->index[best->k - 1])){
+            continue;
+        }
+        j = best->n < best->k ? best->n++ : best->k - 1;
+        for(; j > 0 && suggest_before(s, d, word, best->dist[j - 1],
+                                      best->index[j - 1]); j--){
+            best->dist[j] = best->dist[j - 1];
+            best->index[j] = best->index[j - 1];
+        }
+        best->dist[j] = d;
+        best->index[j] = word;
+    }
+}
+
+/**
+ * Finds the dictionary words closest to a word, within an edit distance
+ * of two, the closest and then the most common first.  The word itself
+ * is found if it is in the dictionary.  Lookups use scratch space in the
+ * suggester, so only one may run at a time.
+ * @param s the suggester.
+ * @param word the word to find suggestions for.
+ * @param k the largest number of suggestions wanted.
+ * @param out set to the suggestions, which last as long as the suggester.
+ * @return the number of suggestions found, at most k.
+ */
+int suggest_lookup(suggest s, char *word, int k, char **out){
+    char prefix[SUGGEST_PREFIX + 1];
+    int len = strlen(word);
+    int i;
+
+    if(k <= 0) return 0;
+    if(k > s->best_size){
+        s->best_size = k;
+        s->best.dist = erealloc(s->best.dist, k * sizeof s->best.dist[0]);
+        s->best.index = erealloc(s->best.index, k * sizeof s->best.index[0]);
+    }
+    s->best.word = word;
+    s->best.k = k;
+    s->best.n = 0;
+    if(++s->stamp == 0){
+        /* the stamp has wrapped around, so forget every word seen */
+        for(i = 0; i < s->num_words; i++) s->seen[i] = 0;
+        s->stamp = 1;
+    }
+    if(len > SUGGEST_PREFIX) len = SUGGEST_PREFIX;
+    memcpy(prefix, word, len);
+    prefix[len] = '\0';
+    suggest_deletes(prefix, len, SUGGEST_DISTANCE, 0, suggest_candidates, s,
+                    0);
+    for(i = 0; i < s->best.n; i++) out[i] = s->words[s->best.index[i]];
+    return s->best.n;
+}
+
+/**
+ * Frees a suggester and the words in it.
+ * @param s the suggester.
+ */
+void suggest_free(suggest s){
+    free(s->words);
+    free(s->freqs);
+    free(s->seen);
+    free(s->keys);
+    free(s->hashes);
+    free(s->heads);
+    free(s->post_word);
+    free(s->post_next);
+    free(s->rows);
+    free(s->best.dist);
+    free(s->best.index);
+    arena_free(s->strings);
+    free(s);
+}
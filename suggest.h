@@ -0,0 +1,12 @@
+#ifndef SUGGEST_H_
+#define SUGGEST_H_
+
+typedef struct suggestrec *suggest;
+
+extern suggest suggest_new(void);
+extern void suggest_add(suggest s, char *word, int freq);
+extern int suggest_lookup(suggest s, char *word, int k, char **out);
+extern void suggest_free(suggest s);
+
+
+#endif
@@ -5,22 +5,74 @@
 #include <time.h>
 #include "tree.h"
 #include "mylib.h"
+#include "bloom.h"
+#include "suggest.h"
+
+/* Bits of Bloom filter for each word in the dictionary. */
+#define BLOOM_BITS 10
+
+/* Most spelling suggestions printed for an unknown word. */
+#define MAX_SUGGESTIONS 32
+
+/* The Bloom filter being built by add_to_filter. */
+static bloom filter;
+
+/* The spelling suggester being built by add_to_speller. */
+static suggest speller;
+
+/* Where print_info writes, in large blocks. */
+static writer out;
+
+/* Words and frequencies collected by add_entry for sorting. */
+static char **entry_words;
+static int *entry_freqs;
+static int num_entries;
 
 static void print_info(int freq, char *word){
-    printf("%-4d %s\n", freq, word);
+    writer_int(out, freq, -4);
+    writer_char(out, ' ');
+    writer_str(out, word);
+    writer_char(out, '\n');
+}
+
+static void add_entry(int freq, char *word){
+    entry_words[num_entries] = word;
+    entry_freqs[num_entries++] = freq;
+}
+
+static void add_to_filter(int freq, char *word){
+    (void) freq;
+    bloom_add(filter, word);
+}
+
+static void add_to_speller(int freq, char *word){
+    suggest_add(speller, word, freq);
 }
 
 static void print_help(){
     fprintf(stderr, "Usage: ./tree-main [OPTION]... <STDIN>\n");
     fprintf(stderr, "\nPerform various operations using a binary tree.  By default, words\n");
     fprintf(stderr, "are read from stdin and added to the tree, before being printed out\n");
-    fprintf(stderr, "\n -c FILENAME  Check spelling of words in FILENAME using words\n");
+    fprintf(stderr, "\n -a ORDER     Print the words sorted by ORDER: freq (most frequent\n");
+    fprintf(stderr, "              first) or alpha\n");
+    fprintf(stderr, " -b           Rule out unknown words with a Bloom filter (if -c\n");
+    fprintf(stderr, "              is used, but not -m) and print its stats\n");
+    fprintf(stderr, " -c FILENAME  Check spelling of words in FILENAME using words\n");
     fprintf(stderr, "              read from stdin as the dictionary.  Print timing\n");
     fprintf(stderr, "              info & unknown words to stderr (ignore -d & -o)\n");
     fprintf(stderr, " -d           Only print the tree depth (ignore -o)\n");
     fprintf(stderr, " -f FILENAME  Write DOT output to FILENAME (if -o given)\n");
+    fprintf(stderr, " -k NUMBER    Follow each unknown word with up to NUMBER of the\n");
+    fprintf(stderr, "              closest known words (if -c is used, but not -m)\n");
+    fprintf(stderr, " -m FILENAME  Map the dictionary from snapshot FILENAME instead\n");
+    fprintf(stderr, "              of reading stdin (only with -c)\n");
+    fprintf(stderr, " -n NUMBER    Print only the NUMBER most frequent words, most\n");
+    fprintf(stderr, "              frequent first\n");
     fprintf(stderr, " -o           Output the tree in DOT form to file 'tree-view.dot'\n");
     fprintf(stderr, " -r           Make the tree an RBT (the default is a BST)\n");
+    fprintf(stderr, " -s           Read all of stdin first and, if it is sorted, build\n");
+    fprintf(stderr, "              a balanced tree from it in linear time\n");
+    fprintf(stderr, " -w FILENAME  Write a snapshot of the tree to FILENAME\n");
     fprintf(stderr, "\n -h           Print this message\n");
 }
 
@@ -36,16 +88,45 @@ int main(int argc, char** argv){
     FILE *infile;
     FILE *outfile = NULL;
     char option;
-    char word[256];
+    char *word;
+    tokenizer tok;
     int unknown = 0;
+    arena words = NULL;
+    char **sorted = NULL;
+    int num_words = 0;
+    int size = 0;
+    char *load_file = NULL;
+    char *save_file = NULL;
 
+    int b = 0;
     int c = 0;
+    int k = 0;
+    int top = 0;
+    int order = 0;
+    char **top_words;
+    int *top_freqs;
+    char *closest[MAX_SUGGESTIONS];
+    int i, n;
     int d = 0;
     int o = 0;
+    int s = 0;
 
-    const char *optstring = "c:df:orh";
+    const char *optstring = "a:bc:df:k:m:n:orsw:h";
     while((option = getopt(argc, argv, optstring)) != EOF){
         switch(option){
+            case 'a':
+                if(strcmp(optarg, "freq") == 0){
+                    order = 'f';
+                } else if(strcmp(optarg, "alpha") == 0){
+                    order = 'a';
+                } else {
+                    print_help();
+                    exit(EXIT_FAILURE);
+                }
+		break;
+            case 'b':
+                b = 1;
+		break;
             case 'c':
                 if(NULL == (infile = fopen(optarg, "r"))){
                     fprintf(stderr, "Can't open file: '%s'\n", optarg);
@@ -59,12 +140,28 @@ int main(int argc, char** argv){
             case 'f':
                 strcpy(graphname, optarg);
 		break;
+            case 'k':
+                k = atoi(optarg);
+                if(k > MAX_SUGGESTIONS) k = MAX_SUGGESTIONS;
+		break;
+            case 'm':
+                load_file = optarg;
+		break;
+            case 'n':
+                top = atoi(optarg);
+		break;
             case 'o':
                 o = 1;
 		break;
             case 'r':
                 type = RBT;
 		break;
+            case 's':
+                s = 1;
+		break;
+            case 'w':
+                save_file = optarg;
+		break;
             case 'h':
                 print_help();
                 exit(EXIT_FAILURE);
@@ -76,30 +173,87 @@ int main(int argc, char** argv){
     }
 
 
-    /* initialise the tree to a new RBT or BST. */
-    t = tree_new(type);
+    if(load_file != NULL && c == 0){
+        print_help();
+        exit(EXIT_FAILURE);
+    }
 
-    /* insert items into tree. */
     start = clock();
-    while(getword(word, sizeof word, stdin) != EOF){
-       t = tree_insert(t, word);
+    if(load_file != NULL){
+        if(NULL == (t = tree_load(load_file))){
+            fprintf(stderr, "Can't load snapshot '%s'\n", load_file);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        /* initialise the tree to a new RBT or BST. */
+        t = tree_new(type);
+
+        /* insert items into tree. */
+        tok = tokenizer_new(stdin, 256);
+        if(s == 1) words = arena_new();
+        while(tokenizer_next(tok, &word) != EOF){
+            if(s == 0){
+                t = tree_insert(t, word);
+                continue;
+            }
+            /* keep every word until the end, to see if they are sorted */
+            if(num_words == size){
+                size = size == 0 ? 1024 : 2 * size;
+                sorted = erealloc(sorted, size * sizeof sorted[0]);
+            }
+            sorted[num_words++] = arena_strdup(words, word);
+        }
+        tokenizer_free(tok);
+        if(s == 1){
+            t = tree_insert_all(t, sorted, num_words);
+            free(sorted);
+            arena_free(words);
+        }
+        /* the tree is only searched from now on */
+        if(c == 1) tree_freeze(t);
+        /* the filter is built from the finished tree, at its final size */
+        if(c == 1 && b == 1){
+            filter = bloom_new(tree_size(t), BLOOM_BITS);
+            tree_inorder(t, add_to_filter);
+        }
+        if(c == 1 && k > 0){
+            speller = suggest_new();
+            tree_inorder(t, add_to_speller);
+        }
     }
     end = clock();
     fill = (end-start)/(double)CLOCKS_PER_SEC;
 
+    if(save_file != NULL && load_file == NULL && !tree_save(t, save_file)){
+        fprintf(stderr, "Can't write snapshot '%s'\n", save_file);
+        exit(EXIT_FAILURE);
+    }
+
     /* Executes if -c is given as an argument. */
     if(c == 1){
         start = clock();
-        while(getword(word, sizeof word, infile) != EOF){
-            if(tree_search(t, word) == 0){
+        tok = tokenizer_new(infile, 256);
+        while(tokenizer_next(tok, &word) != EOF){
+            if((filter != NULL && !bloom_check(filter, word))
+               || tree_search(t, word) == 0){
                 unknown++;
-                printf("%s\n", word);
+                n = speller != NULL
+                    ? suggest_lookup(speller, word, k, closest) : 0;
+                printf("%s", word);
+                for(i = 0; i < n; i++) printf(" %s", closest[i]);
+                printf("\n");
             }
         }
+        tokenizer_free(tok);
         end = clock();
         search = (end-start)/(double)CLOCKS_PER_SEC;
         fprintf(stderr, "Fill time     : %.6f\nSearch time   : %.6f\nUnknown wo\
 rds = %d\n", fill, search, unknown);
+        if(filter != NULL){
+            bloom_print_stats(filter, stderr, unknown);
+            bloom_free(filter);
+        }
+        if(speller != NULL) suggest_free(speller);
         fclose(infile);
         d = 0;
         o = 0;
@@ -117,7 +271,34 @@ rds = %d\n", fill, search, unknown);
         fclose(outfile);
     }
 
-    if(c == 0 && d == 0 && o == 0) tree_preorder(t, print_info);
+    if(c == 0 && d == 0 && o == 0){
+        /* file descriptor 1 is stdout, written to without stdio */
+        out = writer_new(1);
+        if(top > 0){
+            top_words = emalloc(top * sizeof top_words[0]);
+            top_freqs = emalloc(top * sizeof top_freqs[0]);
+            n = tree_top(t, top, top_words, top_freqs);
+            for(i = 0; i < n; i++) print_info(top_freqs[i], top_words[i]);
+            free(top_words);
+            free(top_freqs);
+        } else if(order == 'a'){
+            tree_inorder(t, print_info);
+        } else if(order == 'f'){
+            entry_words = emalloc((tree_size(t) + 1) * sizeof entry_words[0]);
+            entry_freqs = emalloc((tree_size(t) + 1) * sizeof entry_freqs[0]);
+            /* in order, so a stable sort keeps equal ones in word order */
+            tree_inorder(t, add_entry);
+            radix_sort_freqs(entry_words, entry_freqs, num_entries);
+            for(i = 0; i < num_entries; i++){
+                print_info(entry_freqs[i], entry_words[i]);
+            }
+            free(entry_words);
+            free(entry_freqs);
+        } else {
+            tree_preorder(t, print_info);
+        }
+        writer_free(out);
+    }
                 
     tree_free(t);
 
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include "mylib.h"
 #include "tree.h"
 #include <string.h>
@@ -7,46 +8,275 @@
 #define IS_BLACK(x) ((NULL == (x)) || (BLACK == (x)->colour))
 #define IS_RED(x) ((NULL != (x)) && (RED == (x)->colour))
 
-/* holds value passed to tree constructor */
-static type_t tree_type;
+/* true if rbt_fix would change the tree rooted at x */
+#define NEEDS_FIX(x) ((IS_RED((x)->left) && (IS_RED((x)->left->left) \
+                                          || IS_RED((x)->left->right))) \
+                      || (IS_RED((x)->right) && (IS_RED((x)->right->left) \
+                                              || IS_RED((x)->right->right))))
+
+/* depth of a path kept on the stack before using the heap */
+#define TREE_PATH 64
+
+#if defined(__GNUC__)
+#define TREE_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define TREE_PREFETCH(p) ((void) 0)
+#endif
+
+/* slots four levels below slot k of a frozen tree start at this one */
+#define TREE_SLOT_AHEAD(k) (16 * (k))
+
+/* first bytes of a snapshot file, which change with its layout */
+#define TREE_MAGIC "TRE1"
+
+typedef struct tree_node *node;
+
+struct treerec {
+    /* holds value passed to tree constructor */
+    type_t type;
+    int num_nodes;
+    node root;
+    /* storage for the keys of the tree, released by tree_free */
+    arena keys;
+    /* bytes of keys in the arena, and how many belong to deleted keys */
+    size_t key_bytes;
+    size_t dead_bytes;
+    /* deleted nodes waiting to be reused, linked through their left child */
+    node pool;
+    /* search copy made by tree_freeze, or NULL */
+    struct tree_slot *slots;
+    char *slot_keys;
+    /* snapshot mapped by tree_load holding the search copy, or NULL */
+    char *image;
+    size_t image_len;
+};
+
+/*
+ * A key in a frozen tree.  The slots are kept in Eytzinger order, the
+ * children of slot k being slots 2k and 2k + 1, so the first levels
+ * share a few cache lines.  The first four bytes of the key are held
+ * in prefix, most significant first, so most comparisons never look at
+ * the key itself.
+ */
+struct tree_slot {
+    unsigned int prefix;
+    unsigned int offset;
+};
+
+/*
+ * Start of a snapshot file, which is followed by the slots of a frozen
+ * tree, slot 0 included, and then its keys.
+ */
+struct tree_header {
+    char magic[4];
+    unsigned int num_nodes;
+    unsigned int key_bytes;
+};
 
 struct tree_node {
     char *key;
     tree_colour colour;
-    tree left;
-    tree right;
+    node left;
+    node right;
     int frequency;
+    /* nodes on the longest path down to a leaf, and nodes in the subtree */
+    int height;
+    int size;
 };
 
+#define HEIGHT(x) (NULL == (x) ? 0 : (x)->height)
+#define SIZE(x) (NULL == (x) ? 0 : (x)->size)
+
+/* the links followed from the root down to a node */
+struct tree_path {
+    node **link;
+    int depth;
+    int size;
+    node *stack[TREE_PATH];
+};
+
+/**
+ * Starts an empty path.
+ * @param p the path.
+ */
+static void path_init(struct tree_path *p){
+    p->link = p->stack;
+    p->depth = 0;
+    p->size = TREE_PATH;
+}
+
+/**
+ * Adds a link to the end of a path, moving the path to the heap if it
+ * gets too deep for the stack.
+ * @param p the path.
+ * @param link the link to add.
+ */
+static void path_push(struct tree_path *p, node *link){
+    if(p->depth == p->size){
+        p->size *= 2;
+        if(p->link == p->stack){
+            p->link = emalloc(p->size * sizeof p->link[0]);
+            memcpy(p->link, p->stack, sizeof p->stack);
+        } else {
+            p->link = erealloc(p->link, p->size * sizeof p->link[0]);
+        }
+    }
+    p->link[p->depth++] = link;
+}
+
+/**
+ * Frees any memory used by a path.
+ * @param p the path.
+ */
+static void path_free(struct tree_path *p){
+    if(p->link != p->stack){
+        free(p->link);
+    }
+}
+
+/**
+ * Recalculates the height and size of a node from those of its
+ * children, which must already be up to date.
+ * @param n the node, which may be NULL.
+ */
+static void node_update(node n){
+    if(NULL == n){
+        return;
+    }
+    n->height = 1 + (HEIGHT(n->left) > HEIGHT(n->right)
+                     ? HEIGHT(n->left) : HEIGHT(n->right));
+    n->size = 1 + SIZE(n->left) + SIZE(n->right);
+}
+
+/**
+ * Updates the height and size of every node along a path, from the
+ * bottom up.
+ * @param p the path.
+ */
+static void path_update(struct tree_path *p){
+    int i;
+
+    for(i = p->depth - 1; i >= 0; i--){
+        node_update(*p->link[i]);
+    }
+}
+
 /**
- * Creates a new null root as the start of the tree and sets tree_type.
- * to the type of tree being created.
+ * Takes a node from the tree's pool of deleted nodes, or allocates a
+ * new one.
+ * @param b the tree the node is for.
+ * @return the node.
+ */
+static node node_alloc(tree b){
+    node n = b->pool;
+
+    if(NULL == n){
+        return emalloc(sizeof *n);
+    }
+    b->pool = n->left;
+    return n;
+}
+
+/**
+ * Returns a deleted node to the tree's pool for reuse.
+ * @param b the tree the node was in.
+ * @param n the node.
+ */
+static void node_release(tree b, node n){
+    n->left = b->pool;
+    b->pool = n;
+}
+
+/**
+ * Creates a new, empty tree of the given type.  Each tree keeps its
+ * own type, keys and nodes, so separate trees can be built on separate
+ * threads, and a finished tree can be searched from many threads.
  * @param type the type of tree - either RBT or BST.
- * @return null new null space.
+ * @return the new tree.
  */
 tree tree_new(type_t type){
-    tree_type = type;
-    return NULL; 
+    tree b = emalloc(sizeof *b);
+
+    b->type = type;
+    b->num_nodes = 0;
+    b->root = NULL;
+    b->keys = arena_new();
+    b->key_bytes = 0;
+    b->dead_bytes = 0;
+    b->pool = NULL;
+    b->slots = NULL;
+    b->slot_keys = NULL;
+    b->image = NULL;
+    return b; 
 }
 
+/**
+ * Returns the number of keys in the tree.
+ * @param b the tree.
+ * @return the number of keys.
+ */
+int tree_size(tree b){
+    return b->num_nodes;
+}
+
+
+/**
+ * Throws away the search copy made by tree_freeze, if there is one.
+ * @param b the tree.
+ */
+static void tree_thaw(tree b){
+    if(b->image != NULL){
+        unmap_file(b->image, b->image_len);
+        b->image = NULL;
+    } else {
+        free(b->slots);
+        free(b->slot_keys);
+    }
+    b->slots = NULL;
+    b->slot_keys = NULL;
+}
 
 /**
- * Frees memory associated with given tree.
+ * Frees the nodes of given subtree.  Left children are rotated up until
+ * the top node has none, so it can be freed without a stack however
+ * deep the subtree is.
+ * @param b the subtree to free.
+ */
+static void tree_free_nodes(node b){
+    node next;
+
+    while(NULL != b){
+        if(NULL != b->left){
+            next = b->left;
+            b->left = next->right;
+            next->right = b;
+        } else {
+            next = b->right;
+            free(b);
+        }
+        b = next;
+    }
+}
+
+/**
+ * Frees memory associated with given tree, including the arena that
+ * holds its keys and the pool of deleted nodes.
  * @param b the tree to free.
- * @return b the freed tree.
+ * @return NULL.
  */
 tree tree_free(tree b){
-    if(NULL == b){
-        return b;
+    node n;
+
+    tree_free_nodes(b->root);
+    while(NULL != (n = b->pool)){
+        b->pool = n->left;
+        free(n);
     }
-    
-    tree_free(b->left);
-    
-    tree_free(b->right);
-    free(b->key);
+    arena_free(b->keys);
+    tree_thaw(b);
     free(b);
 
-    return b;
+    return NULL;
 }
 
 /**
@@ -54,13 +284,15 @@ tree tree_free(tree b){
  * @param r the parent node to rotate on.
  * @return r the resulting parent node after rotation.
  */
-static tree right_rotate(tree r){
-    tree temp;
+static node right_rotate(node r){
+    node temp;
     temp = r;
     r = temp->left;
   
     temp->left = r->right;
     r->right = temp;
+    node_update(temp);
+    node_update(r);
     return r;
 }
 
@@ -69,13 +301,15 @@ static tree right_rotate(tree r){
  * @param r the parent node to rotate on.
  * @return r the resulting parent node after rotation.
  */
-static tree left_rotate(tree r){
-    tree temp;
+static node left_rotate(node r){
+    node temp;
     temp = r;
     r = temp->right;
  
     temp->right = r->left;
     r->left = temp;
+    node_update(temp);
+    node_update(r);
     return r;
 }
 
@@ -84,7 +318,7 @@ static tree left_rotate(tree r){
  * @param r the tree to be fixed
  * @return r the fixed RBT 
  */
-static tree rbt_fix(tree r){
+static node rbt_fix(node r){
     if(IS_RED(r->left) && IS_RED(r->left->left)){
         if(IS_RED(r->right)){
             r->colour = RED;
@@ -133,138 +367,759 @@ static tree rbt_fix(tree r){
 
 /**
  * Inserts the key into given tree, if the tree is an RBT then rbt_fix is
- * called after insertion.
+ * applied to every node on the path from the key back up to the root,
+ * wherever it would change something.
+ * The tree is walked iteratively with one comparison per node, so deep
+ * trees cannot overflow the call stack.  The height and size of each
+ * node on the path are updated on the way back up.  Any frozen copy
+ * of the tree is thrown away.
  * @param b the tree that the key will be inserted into.
  * @param str the key to add to the tree.
  * @return b the resuling tree after insertion.
  */
 tree tree_insert(tree b, char *str){
-    
-    if(b == NULL){
-        b = emalloc(sizeof *b);
-        if(tree_type == RBT){
-            b->colour = RED;
+    struct tree_path path;
+    node *link = &b->root;
+    int cmp;
+
+    tree_thaw(b);
+    path_init(&path);
+    while(*link != NULL){
+        path_push(&path, link);
+        cmp = strcmp(str, (*link)->key);
+        /* if duplicate item added, increment frequency */
+        if(cmp == 0){
+            (*link)->frequency += 1;
+            break;
+        }
+        /* if str is smaller go left, if it is bigger go right */
+        link = cmp < 0 ? &(*link)->left : &(*link)->right;
+    }
+
+    if(*link == NULL){
+        *link = node_alloc(b);
+        (*link)->colour = RED;
+        (*link)->left = NULL;
+        (*link)->right = NULL;
+        (*link)->key = arena_strdup(b->keys, str);
+        b->key_bytes += strlen(str) + 1;
+        (*link)->frequency = 1;
+        (*link)->height = 1;
+        (*link)->size = 1;
+        b->num_nodes++;
+    } else if(b->type != RBT){
+        /* a duplicate leaves a BST unchanged */
+        path.depth = 0;
+    }
+
+    /* if tree is RBT fix after insert, from the bottom up */
+    while(path.depth-- > 0){
+        if(b->type == RBT && NEEDS_FIX(*path.link[path.depth])){
+            *path.link[path.depth] = rbt_fix(*path.link[path.depth]);
+        }
+        node_update(*path.link[path.depth]);
+    }
+    path_free(&path);
+    return b;
+}
+
+/**
+ * Builds a perfectly balanced subtree from a run of distinct sorted keys
+ * by making the middle key the root.  The levels above the deepest one
+ * are full, so an RBT gets the same black height on every path by
+ * colouring only the deepest level red.
+ * @param b the tree being built.
+ * @param keys the distinct keys in order.
+ * @param freqs the frequency of each key.
+ * @param n the number of keys in the run.
+ * @param depth the depth of the root of the subtree.
+ * @param red_depth the depth whose nodes are red in an RBT.
+ * @return the root of the subtree.
+ */
+static node build_sorted(tree b, char **keys, int *freqs, int n, int depth,
+                         int red_depth){
+    int mid = n / 2;
+    node n_root;
+
+    if(n == 0){
+        return NULL;
+    }
+    n_root = node_alloc(b);
+    n_root->key = arena_strdup(b->keys, keys[mid]);
+    b->key_bytes += strlen(keys[mid]) + 1;
+    n_root->frequency = freqs[mid];
+    n_root->colour = (b->type == RBT && depth == red_depth) ? RED : BLACK;
+    n_root->left = build_sorted(b, keys, freqs, mid, depth + 1, red_depth);
+    n_root->right = build_sorted(b, keys + mid + 1, freqs + mid + 1,
+                                 n - mid - 1, depth + 1, red_depth);
+    node_update(n_root);
+    return n_root;
+}
+
+/**
+ * Inserts many keys into given tree.  If the tree is empty and the keys
+ * are already in sorted order, as they are in most dictionaries, the
+ * tree is built directly in linear time, perfectly balanced, with the
+ * repeats of a key counted in its frequency.  Otherwise each key is
+ * added with tree_insert.
+ * @param b the tree that the keys will be inserted into.
+ * @param keys the keys to add to the tree.
+ * @param n the number of keys.
+ * @return b the resulting tree after insertion.
+ */
+tree tree_insert_all(tree b, char **keys, int n){
+    char **distinct;
+    int *freqs;
+    int m = 0;
+    int depth = 0;
+    int i;
+
+    for(i = 1; i < n && strcmp(keys[i - 1], keys[i]) <= 0; i++){
+        ;
+    }
+    if(b->root != NULL || i < n){
+        for(i = 0; i < n; i++){
+            b = tree_insert(b, keys[i]);
+        }
+        return b;
+    }
+
+    distinct = emalloc((n + 1) * sizeof distinct[0]);
+    freqs = emalloc((n + 1) * sizeof freqs[0]);
+    for(i = 0; i < n; i++){
+        if(m > 0 && strcmp(distinct[m - 1], keys[i]) == 0){
+            freqs[m - 1]++;
+        } else {
+            distinct[m] = keys[i];
+            freqs[m++] = 1;
+        }
+    }
+    /* the deepest level of a tree of m nodes, red unless it is the root */
+    while((2L << depth) <= m){
+        depth++;
+    }
+    tree_thaw(b);
+    b->root = build_sorted(b, distinct, freqs, m, 0, depth > 0 ? depth : -1);
+    b->num_nodes = m;
+    free(distinct);
+    free(freqs);
+    return b;
+}
+
+/**
+ * Restores the black height of an RBT after a black node has been
+ * removed from below the last link in the path, leaving the subtree
+ * there one black node short.  Follows the usual red-black deletion
+ * cases, rotating at the links in the path as it moves up.  The path
+ * is left holding only the links above the last change, whose heights
+ * may still need updating.
+ * @param p the path from the root down to the short subtree.
+ */
+static void rbt_delete_fix(struct tree_path *p){
+    int k = p->depth - 1;
+    node x = *p->link[k];
+    node parent;
+    node w;
+
+    while(k > 0 && IS_BLACK(x)){
+        parent = *p->link[k - 1];
+        if(p->link[k] == &parent->left){
+            w = parent->right;
+            if(IS_RED(w)){
+                /* make the sibling black, x moves one level down */
+                w->colour = BLACK;
+                parent->colour = RED;
+                *p->link[k - 1] = left_rotate(parent);
+                path_push(p, NULL);
+                p->link[k] = &w->left;
+                p->link[++k] = &parent->left;
+                w = parent->right;
+            }
+            if(IS_BLACK(w->left) && IS_BLACK(w->right)){
+                w->colour = RED;
+                x = parent;
+                k--;
+                continue;
+            }
+            if(IS_BLACK(w->right)){
+                w->left->colour = BLACK;
+                w->colour = RED;
+                w = parent->right = right_rotate(w);
+            }
+            w->colour = parent->colour;
+            parent->colour = BLACK;
+            w->right->colour = BLACK;
+            *p->link[k - 1] = left_rotate(parent);
+            p->depth = k;
+            return;
+        } else {
+            w = parent->left;
+            if(IS_RED(w)){
+                w->colour = BLACK;
+                parent->colour = RED;
+                *p->link[k - 1] = right_rotate(parent);
+                path_push(p, NULL);
+                p->link[k] = &w->right;
+                p->link[++k] = &parent->right;
+                w = parent->left;
+            }
+            if(IS_BLACK(w->left) && IS_BLACK(w->right)){
+                w->colour = RED;
+                x = parent;
+                k--;
+                continue;
+            }
+            if(IS_BLACK(w->left)){
+                w->right->colour = BLACK;
+                w->colour = RED;
+                w = parent->left = left_rotate(w);
+            }
+            w->colour = parent->colour;
+            parent->colour = BLACK;
+            w->left->colour = BLACK;
+            *p->link[k - 1] = right_rotate(parent);
+            p->depth = k;
+            return;
+        }
+    }
+    if(x != NULL){
+        x->colour = BLACK;
+    }
+    p->depth = k + 1;
+}
+
+/**
+ * Copies the keys of the tree into a new arena and frees the old one,
+ * which also held the keys of deleted nodes.
+ * @param b the tree.
+ */
+static void tree_compact_keys(tree b){
+    struct tree_path path;
+    arena keys = arena_new();
+    node n = b->root;
+
+    /* a pre-order walk, keeping the right subtrees still to visit */
+    path_init(&path);
+    while(NULL != n || path.depth > 0){
+        if(NULL == n){
+            n = *path.link[--path.depth];
         }
-        b->left = NULL;
-        b->right = NULL;
-        b->key = NULL;
+        n->key = arena_strdup(keys, n->key);
+        if(NULL != n->right){
+            path_push(&path, &n->right);
+        }
+        n = n->left;
     }
-    if(b->key == NULL){
-        b->key = emalloc((strlen(str)+1)*sizeof (char));
-        strcpy(b->key, str);
+    path_free(&path);
+    arena_free(b->keys);
+    b->keys = keys;
+    b->key_bytes -= b->dead_bytes;
+    b->dead_bytes = 0;
+}
+
+/**
+ * Removes a key from given tree, whatever its frequency.  A node with
+ * two children takes the key of its in-order successor, which is
+ * removed instead.  If the tree is an RBT and the removed node was
+ * black, rbt_delete_fix restores the balance.  The removed node goes
+ * back to the node pool, and the height and size of the nodes above it
+ * are updated.  Any frozen copy of the tree is thrown away.  The keys
+ * are copied into a new arena once deleted keys take up more than half
+ * of it, so a tree that keeps changing stays in bounded memory.
+ * @param b the tree to remove the key from.
+ * @param str the key to remove.
+ * @return b the resulting tree, unchanged if the key was not present.
+ */
+tree tree_delete(tree b, char *str){
+    struct tree_path path;
+    node *link = &b->root;
+    node z;
+    node y;
+    int cmp;
+
+    tree_thaw(b);
+    path_init(&path);
+    while(*link != NULL && (cmp = strcmp(str, (*link)->key)) != 0){
+        path_push(&path, link);
+        link = cmp < 0 ? &(*link)->left : &(*link)->right;
     }
-    /* if duplicate item added, increment frequency */
-    if(strcmp(b->key, str) == 0){
-        b->frequency += 1;
+    if(*link == NULL){
+        path_free(&path);
+        return b;
     }
-    /* if str is smaller, go left */
-    if(strcmp(str, b->key) < 0){
-        b->left = tree_insert(b->left, str);
+
+    z = *link;
+    b->dead_bytes += strlen(z->key) + 1;
+    path_push(&path, link);
+    if(z->left != NULL && z->right != NULL){
+        /* find the successor and move its key into z */
+        link = &z->right;
+        path_push(&path, link);
+        while((*link)->left != NULL){
+            link = &(*link)->left;
+            path_push(&path, link);
+        }
+        y = *link;
+        z->key = y->key;
+        z->frequency = y->frequency;
+        z = y;
     }
-    /* if str is bigger, go right */
-    if(strcmp(str, b->key) > 0){
-        b->right = tree_insert(b->right, str);
+
+    /* z now has at most one child, which takes its place */
+    *link = z->left != NULL ? z->left : z->right;
+    path_update(&path);
+    if(b->type == RBT && BLACK == z->colour){
+        /* rotations leave the nodes above them out of date */
+        rbt_delete_fix(&path);
+        path_update(&path);
     }
-    /* if tree is RBT fix after insert */
-    if(tree_type == RBT){
-        b = rbt_fix(b);
+    node_release(b, z);
+    b->num_nodes--;
+    path_free(&path);
+    if(2 * b->dead_bytes > b->key_bytes){
+        tree_compact_keys(b);
     }
     return b;
 }
 
 
 /**
- * Applies given function to each key in pre-order traversal.
+ * Applies given function to each key in pre-order traversal.  The right
+ * subtrees still to be visited are kept on a path rather than the call
+ * stack, so an unbalanced BST cannot overflow it.
  * @param b the tree to traverse.
  * @param f the function to be applied to each key.
  * @param str the key to apply function to.
  */
 void tree_preorder(tree b, void f(int freq, char *str)){
-    if(NULL == b){
-        return;
+    struct tree_path path;
+    node n = b->root;
+
+    path_init(&path);
+    while(NULL != n || path.depth > 0){
+        if(NULL == n){
+            n = *path.link[--path.depth];
+        }
+        f(n->frequency, n->key);
+        if(NULL != n->right){
+            path_push(&path, &n->right);
+        }
+        n = n->left;
     }
-    f(b->frequency, b->key);
-    tree_preorder(b->left, f);
-    tree_preorder(b->right,f);
+    path_free(&path);
 }
 
 /**
- * Applied given function to each key in in-order traversal.
+ * Applied given function to each key in in-order traversal.  The nodes
+ * whose left subtrees are being visited are kept on a path rather than
+ * the call stack.
  * @param b the tree to traverse.
  * @param f the function to be applied to each key.
  * @param str the key to apply the function to.
- * @param c the colour of the node the key is in - used for RBT only.
  */
 void tree_inorder(tree b, void f (int freq, char *str)){
-    if(NULL == b){
+    struct tree_path path;
+    node *link = &b->root;
+    node n;
+
+    path_init(&path);
+    for(;;){
+        while(NULL != *link){
+            path_push(&path, link);
+            link = &(*link)->left;
+        }
+        if(path.depth == 0){
+            break;
+        }
+        n = *path.link[--path.depth];
+        f(n->frequency, n->key);
+        link = &n->right;
+    }
+    path_free(&path);
+}
+
+/**
+ * Packs the first four bytes of a string into an integer which orders
+ * the same way strcmp does.  Bytes after the end of the string are 0.
+ * @param str the string.
+ * @return the packed bytes.
+ */
+static unsigned int key_prefix(const char *str){
+    unsigned int prefix = 0;
+    int i;
+
+    for(i = 0; i < 4; i++){
+        prefix <<= 8;
+        if(*str != '\0'){
+            prefix |= (unsigned char) *str++;
+        }
+    }
+    return prefix;
+}
+
+/**
+ * Collects the nodes of a tree in order, keeping the nodes whose left
+ * subtrees are being collected on a path rather than the call stack.
+ * @param b the tree.
+ * @param sorted the array to fill.
+ */
+static void collect(tree b, node *sorted){
+    struct tree_path path;
+    node *link = &b->root;
+    int i = 0;
+
+    path_init(&path);
+    for(;;){
+        while(NULL != *link){
+            path_push(&path, link);
+            link = &(*link)->left;
+        }
+        if(path.depth == 0){
+            break;
+        }
+        sorted[i] = *path.link[--path.depth];
+        link = &sorted[i++]->right;
+    }
+    path_free(&path);
+}
+
+/**
+ * Lays out the keys of the sorted nodes in Eytzinger order, by an in
+ * order walk of the implicit tree rooted at slot k.
+ * @param b the tree being frozen.
+ * @param sorted the nodes of the tree in order.
+ * @param i the index in sorted of the next key to place.
+ * @param k the slot to fill.
+ * @param offset set to the place in slot_keys of the next key.
+ * @return the index in sorted of the next key to place after this subtree.
+ */
+static int freeze(tree b, node *sorted, int i, int k, unsigned int *offset){
+    if(k > b->num_nodes){
+        return i;
+    }
+    i = freeze(b, sorted, i, 2 * k, offset);
+    b->slots[k].prefix = key_prefix(sorted[i]->key);
+    b->slots[k].offset = *offset;
+    strcpy(b->slot_keys + *offset, sorted[i]->key);
+    *offset += strlen(sorted[i]->key) + 1;
+    return freeze(b, sorted, i + 1, 2 * k + 1, offset);
+}
+
+/**
+ * Makes a compact read-only copy of the tree which tree_search uses
+ * instead of the nodes.  The keys are copied next to each other in
+ * the same order as their slots, so a search touches a few cache lines
+ * near the start of each array rather than a node per level.  The copy
+ * lasts until the tree is next changed.  Keys taking up 4 GiB or more
+ * have offsets too large for a slot, so such a tree is not frozen.
+ * @param b the tree to freeze.
+ */
+void tree_freeze(tree b){
+    node *sorted;
+    size_t bytes = 0;
+    unsigned int offset = 0;
+    int i;
+
+    tree_thaw(b);
+    sorted = emalloc((b->num_nodes + 1) * sizeof sorted[0]);
+    collect(b, sorted);
+    for(i = 0; i < b->num_nodes; i++){
+        bytes += strlen(sorted[i]->key) + 1;
+    }
+    if(bytes > UINT_MAX){
+        free(sorted);
         return;
     }
-    
-    tree_inorder(b->left, f);
-    f(b->frequency, b->key);
-    tree_inorder(b->right,f); 
+    /* slot 0 is unused, so the children of slot k are 2k and 2k + 1 */
+    b->slots = emalloc((b->num_nodes + 1) * sizeof b->slots[0]);
+    b->slot_keys = emalloc(bytes + 1);
+    freeze(b, sorted, 0, 1, &offset);
+    /* slot 0 is otherwise unused, so it records the size of slot_keys */
+    b->slots[0].prefix = 0;
+    b->slots[0].offset = offset;
+    free(sorted);
 }
 
 /**
- * Searches tree for given key.
- * @param b the tree to be searched.
- * @param str the key to search for.
- * @return 1 if key is null or 0 if key is found.
+ * Writes a snapshot of the frozen form of the tree to a file, freezing
+ * the tree first if need be.  The snapshot holds the slots and keys as
+ * they are laid out in memory, so tree_load can map it back directly.
+ * @param b the tree to save.
+ * @param path the name of the file to write.
+ * @return 1 if the snapshot was written, 0 otherwise, as when the tree
+ * is too big to freeze.
  */
-int tree_search(tree b, char *str){
-    if(b == NULL){
+int tree_save(tree b, const char *path){
+    struct tree_header header;
+    size_t n = b->num_nodes + 1;
+    FILE *out;
+    int ok;
+
+    if(b->slots == NULL){
+        tree_freeze(b);
+    }
+    if(b->slots == NULL || NULL == (out = fopen(path, "wb"))){
         return 0;
     }
-    if(strcmp(str, b->key) == 0){
-        return 1;
+    memcpy(header.magic, TREE_MAGIC, sizeof header.magic);
+    header.num_nodes = b->num_nodes;
+    header.key_bytes = b->slots[0].offset;
+    ok = fwrite(&header, sizeof header, 1, out) == 1
+        && fwrite(b->slots, sizeof b->slots[0], n, out) == n
+        && fwrite(b->slot_keys, 1, header.key_bytes, out) == header.key_bytes;
+    return fclose(out) == 0 && ok;
+}
+
+/**
+ * Maps a snapshot written by tree_save into memory as a frozen tree,
+ * without reading or allocating anything per key.  The tree can only
+ * be searched and freed, since the nodes it was frozen from are gone.
+ * Each slot is checked so that a search never reads past the keys,
+ * which must end with a '\0'.
+ * @param path the name of the snapshot file.
+ * @return the tree, or NULL if the file could not be mapped or is not
+ * a snapshot.
+ */
+tree tree_load(const char *path){
+    struct tree_header *header;
+    struct tree_slot *slots;
+    size_t len;
+    size_t n;
+    size_t i;
+    char *image = map_file(path, &len);
+    tree b;
+
+    if(NULL == image){
+        return NULL;
     }
-    if(strcmp(str, b->key) < 0){
-        return tree_search(b->left, str);
+    header = (struct tree_header *) image;
+    n = len < sizeof *header ? 0 : header->num_nodes + (size_t) 1;
+    if(n == 0 || memcmp(header->magic, TREE_MAGIC, sizeof header->magic) != 0
+       || header->num_nodes > INT_MAX
+       || (len - sizeof *header) / sizeof slots[0] < n
+       || len - sizeof *header - n * sizeof slots[0] != header->key_bytes
+       || (header->key_bytes > 0 && image[len - 1] != '\0')){
+        unmap_file(image, len);
+        return NULL;
     }
-    if(strcmp(str, b->key) > 0){
-        return tree_search(b->right, str);
+    /* a key whose prefix does not end it is compared from its fifth byte */
+    slots = (struct tree_slot *) (image + sizeof *header);
+    for(i = 1; i < n; i++){
+        if(slots[i].offset >= header->key_bytes
+           || ((slots[i].prefix & 0xff) != 0
+               && header->key_bytes - slots[i].offset <= 4)){
+            unmap_file(image, len);
+            return NULL;
+        }
+    }
+
+    b = tree_new(BST);
+    b->num_nodes = header->num_nodes;
+    b->image = image;
+    b->image_len = len;
+    b->slots = slots;
+    b->slot_keys = (char *) (slots + n);
+    return b;
+}
+
+/**
+ * Searches a frozen tree.  The next slot is worked out from the result
+ * of the comparison rather than branched to, and slots a few levels
+ * down are prefetched while the current one is compared.
+ * @param b the frozen tree.
+ * @param str the key to search for.
+ * @return 1 if key is found or 0 if it is not.
+ */
+static int frozen_search(tree b, char *str){
+    unsigned int prefix = key_prefix(str);
+    unsigned int n = b->num_nodes;
+    unsigned int k = 1;
+    struct tree_slot *slot;
+    int cmp;
+
+    while(k <= n){
+        /* a pointer past the end of the slots may not even be formed */
+        if(k <= n / TREE_SLOT_AHEAD(1)){
+            TREE_PREFETCH(b->slots + TREE_SLOT_AHEAD(k));
+        }
+        slot = b->slots + k;
+        if(prefix != slot->prefix){
+            cmp = prefix > slot->prefix;
+        } else if((prefix & 0xff) == 0){
+            /* str ends within the prefix, so it equals the key */
+            return 1;
+        } else {
+            cmp = strcmp(str + 4, b->slot_keys + slot->offset + 4);
+            if(cmp == 0){
+                return 1;
+            }
+            cmp = cmp > 0;
+        }
+        k = 2 * k + cmp;
     }
     return 0;
 }
 
 /**
- * Calculates the length of the longest  path between root node
- * and furthest leaf node.
+ * Finds the k most frequent keys in the tree with a bounded heap, in
+ * O(n log k) rather than sorting every key.
+ * @param b the tree.
+ * @param k the largest number of keys wanted.
+ * @param words set to the keys, most frequent first, with ties in
+ * alphabetical order.  There must be room for k.
+ * @param freqs set to the frequency of each key, with room for k.
+ * @return the number of keys found, which is k unless the tree holds
+ * fewer keys.
+ */
+int tree_top(tree b, int k, char **words, int *freqs){
+    struct tree_path path;
+    node t = b->root;
+    int n = 0;
+
+    /* a pre-order walk, keeping the right subtrees still to visit */
+    path_init(&path);
+    while(NULL != t || path.depth > 0){
+        if(NULL == t){
+            t = *path.link[--path.depth];
+        }
+        n = topk_add(words, freqs, n, k, t->key, t->frequency);
+        if(NULL != t->right){
+            path_push(&path, &t->right);
+        }
+        t = t->left;
+    }
+    path_free(&path);
+    topk_sort(words, freqs, n);
+    return n;
+}
+
+/**
+ * Searches tree for given key, comparing it with each node once.  A
+ * frozen tree is searched through its compact copy.
+ * @param b the tree to be searched.
+ * @param str the key to search for.
+ * @return 1 if key is found or 0 if it is not.
+ */
+int tree_search(tree b, char *str){
+    node n = b->root;
+    int cmp;
+
+    if(b->slots != NULL){
+        return frozen_search(b, str);
+    }
+    while(n != NULL){
+        cmp = strcmp(str, n->key);
+        if(cmp == 0){
+            return 1;
+        }
+        n = cmp < 0 ? n->left : n->right;
+    }
+    return 0;
+}
+
+/**
+ * Returns the length of the longest  path between root node
+ * and furthest leaf node, which is kept up to date by insert and delete.
  * @param b the tree to find the depth of.
- * @return depth of the tree, or zero if tree is null.
+ * @return depth of the tree, or zero if tree is empty.
  */
 int tree_depth(tree b){
-    if(b == NULL){
-        return 0;
+    return NULL == b->root ? 0 : b->root->height - 1;
+}
+
+/**
+ * Counts the keys in the tree that sort before the given key, using the
+ * subtree sizes to skip whole left subtrees.
+ * @param b the tree to search.
+ * @param str the key, which need not be in the tree.
+ * @return the number of keys less than str.
+ */
+int tree_rank(tree b, char *str){
+    node n = b->root;
+    int rank = 0;
+    int cmp;
+
+    while(n != NULL){
+        cmp = strcmp(str, n->key);
+        if(cmp <= 0){
+            if(cmp == 0){
+                return rank + SIZE(n->left);
+            }
+            n = n->left;
+        } else {
+            rank += SIZE(n->left) + 1;
+            n = n->right;
+        }
+    }
+    return rank;
+}
+
+/**
+ * Finds the key at the given position in sorted order, so that
+ * tree_select(b, tree_rank(b, str)) is str for any key in the tree.
+ * @param b the tree to search.
+ * @param k the position, counting from zero.
+ * @return the key, or NULL if k is not less than the size of the tree.
+ */
+char *tree_select(tree b, int k){
+    node n = b->root;
+
+    if(k < 0){
+        return NULL;
     }
-    if(b->left == NULL && b->right == NULL) return 0;
-    if(tree_depth(b->left) > tree_depth(b->right)){
-        return (tree_depth(b->left) + 1);
+    while(n != NULL){
+        if(k < SIZE(n->left)){
+            n = n->left;
+        } else if(k == SIZE(n->left)){
+            return n->key;
+        } else {
+            k -= SIZE(n->left) + 1;
+            n = n->right;
+        }
     }
-    return (tree_depth(b->right) + 1);
+    return NULL;
 }
 
 /**
  * Traverses the tree writing a DOT description about connections, and
- * possibly colours, to the given output stream.
+ * possibly colours, to the given output stream.  The nodes above the
+ * current one are kept on a path, and the link last come back up tells
+ * which of a node's children have been written, so the output is the
+ * same as a recursive walk without using the call stack.
  *
- * @param t the tree to output a DOT description of.
+ * @param root the link to the subtree to output a DOT description of.
+ * @param type the type of the tree, which decides the colours.
  * @param out the stream to write the DOT output to.
  */
-static void tree_output_dot_aux(tree t, FILE *out) {
-    if(t->key != NULL) {
-        fprintf(out, "\"%s\"[label=\"{<f0>%s:%d|{<f1>|<f2>}}\"color=%s];\n",
-                t->key, t->key, t->frequency,
-                (RBT == tree_type && RED == t->colour) ? "red":"black");
-    }
-    if(t->left != NULL) {
-        tree_output_dot_aux(t->left, out);
-        fprintf(out, "\"%s\":f1 -> \"%s\":f0;\n", t->key, t->left->key);
-    }
-    if(t->right != NULL) {
-        tree_output_dot_aux(t->right, out);
-        fprintf(out, "\"%s\":f2 -> \"%s\":f0;\n", t->key, t->right->key);
+static void tree_output_dot_aux(node *root, type_t type, FILE *out) {
+    struct tree_path path;
+    node *from = NULL;
+    node t;
+
+    path_init(&path);
+    path_push(&path, root);
+    while(path.depth > 0) {
+        t = *path.link[path.depth - 1];
+        if(from == NULL && t->key != NULL) {
+            fprintf(out, "\"%s\"[label=\"{<f0>%s:%d|{<f1>|<f2>}}\"color=%s];\n",
+                    t->key, t->key, t->frequency,
+                    (RBT == type && RED == t->colour) ? "red":"black");
+        }
+        if(from == &t->left) {
+            fprintf(out, "\"%s\":f1 -> \"%s\":f0;\n", t->key, t->left->key);
+        } else if(from == &t->right) {
+            fprintf(out, "\"%s\":f2 -> \"%s\":f0;\n", t->key, t->right->key);
+        }
+        if(from == NULL && t->left != NULL) {
+            path_push(&path, &t->left);
+        } else if(from != &t->right && t->right != NULL) {
+            path_push(&path, &t->right);
+            from = NULL;
+        } else {
+            from = path.link[--path.depth];
+        }
     }
+    path_free(&path);
 }
 
 /**
@@ -281,6 +1136,8 @@ static void tree_output_dot_aux(tree t, FILE *out) {
  */
 void tree_output_dot(tree t, FILE *out) {
     fprintf(out, "digraph tree {\nnode [shape = Mrecord, penwidth = 2];\n");
-    tree_output_dot_aux(t, out);
+    if(t->root != NULL) {
+        tree_output_dot_aux(&t->root, t->type, out);
+    }
     fprintf(out, "}\n");
 }
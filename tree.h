@@ -1,7 +1,7 @@
 #ifndef RBT_H_
 #define RBT_H_
 
-typedef struct tree_node *tree;
+typedef struct treerec *tree;
 typedef char type_t;
 
 typedef enum { RED, BLACK } tree_colour;
@@ -10,11 +10,19 @@ typedef enum tree_e { BST, RBT } tree_t;
 extern tree tree_delete(tree b, char *str);
 extern tree tree_free(tree b);
 extern tree tree_insert(tree b, char *str);
+extern tree tree_insert_all(tree b, char **keys, int n);
 extern tree tree_new(type_t type);
 extern void tree_preorder(tree b, void f(int freq, char *str));
 extern void tree_inorder(tree b, void f(int freq, char *str));
+extern int tree_top(tree b, int k, char **words, int *freqs);
 extern int tree_search(tree b, char *str);
+extern void tree_freeze(tree b);
+extern int tree_save(tree b, const char *path);
+extern tree tree_load(const char *path);
 extern int tree_depth(tree b);
+extern int tree_size(tree b);
+extern int tree_rank(tree b, char *str);
+extern char *tree_select(tree b, int k);
 extern void tree_output_dot(tree t, FILE *out);
 
 